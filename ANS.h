@@ -0,0 +1,349 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+// Table-based asymmetric numeral system (tANS) coder. The input is coded in independent blocks, each
+// written as its size (32 bits), the symbol frequencies scaled to tableSize, the final coder state
+// and the bits the coder emitted for every symbol, in the order the decoder reads them back.
+class ANS : public Archiver
+{
+private:
+    static const int tableLog = 11;
+    static const int tableSize = 1 << tableLog;
+    static const int writeBlockSize = 64 * 1024;
+
+    struct DecodeEntry
+    {
+    public:
+        unsigned short newStateBase;
+        unsigned char symbol;
+        unsigned char bitsCount;
+    };
+
+    int blockSize;
+
+    static int getHighBit(unsigned int value)
+    {
+        int bit = 0;
+        while ((value >> (bit + 1)) != 0)
+        {
+            ++bit;
+        }
+
+        return bit;
+    }
+
+    // Scales the counts to frequencies that sum up to tableSize; every present symbol keeps at least 1.
+    void normalize(const ll* counts, ll total, int* frequencies)
+    {
+        int sum = 0;
+        int largest = 0;
+
+        for (int byte = 0; byte < 256; ++byte)
+        {
+            frequencies[byte] = 0;
+            if (counts[byte] > 0)
+            {
+                frequencies[byte] = (int)std::max(1ULL, (counts[byte] * tableSize + total / 2) / total);
+                sum += frequencies[byte];
+
+                if (counts[byte] > counts[largest])
+                {
+                    largest = byte;
+                }
+            }
+        }
+
+        while (sum > tableSize)
+        {
+            --*std::max_element(frequencies, frequencies + 256);
+            --sum;
+        }
+
+        frequencies[largest] += tableSize - sum;
+    }
+
+    // Deals the states out to the symbols, each symbol getting as many as its frequency, with a step
+    // that spreads the states of a symbol over the whole table.
+    void spreadSymbols(const int* frequencies, unsigned char* symbols)
+    {
+        int step = (tableSize >> 1) + (tableSize >> 3) + 3;
+        int position = 0;
+
+        for (int byte = 0; byte < 256; ++byte)
+        {
+            for (int i = 0; i < frequencies[byte]; ++i)
+            {
+                symbols[position] = (unsigned char)byte;
+                position = (position + step) & (tableSize - 1);
+            }
+        }
+    }
+
+    void flushBytes(std::vector<unsigned char>& bytes, FileWriter* fileWriter, size_t minSize)
+    {
+        if (fileWriter != nullptr && bytes.size() >= minSize && bytes.size() > 0)
+        {
+            fileWriter->Write(&bytes);
+            bytes.clear();
+        }
+    }
+
+    void encodeBlock(const unsigned char* bytes, int size, BitWriter& bitWriter, std::vector<unsigned char>& bytesToWrite, FileWriter* fileWriter)
+    {
+        if (size == 0)
+        {
+            return;
+        }
+
+        ll counts[256] = {};
+        countBytes(bytes, size, counts);
+        STATS_ADD(tokens, size);
+
+        int frequencies[256];
+        int tableValues[256];
+        normalize(counts, size, frequencies);
+
+        for (int byte = 0; byte < 256; ++byte)
+        {
+            tableValues[byte] = frequencies[byte] - 1;
+        }
+
+        // The state of the j-th occurrence of a symbol in the spread table, j counted from the
+        // symbol's first slot in cumulative order.
+        unsigned char symbols[tableSize];
+        unsigned short stateTable[tableSize];
+        int cumulative[256];
+        int next[256];
+
+        spreadSymbols(frequencies, symbols);
+        for (int byte = 0, total = 0; byte < 256; ++byte)
+        {
+            cumulative[byte] = next[byte] = total;
+            total += frequencies[byte];
+        }
+
+        for (int position = 0; position < tableSize; ++position)
+        {
+            stateTable[next[symbols[position]]++] = (unsigned short)(tableSize + position);
+        }
+
+        // Symbols are coded from the last to the first so that they decode in order; the bits
+        // emitted for each are kept until the final state is known and then written front to back.
+        std::vector<unsigned int> emitted(size);
+        unsigned int state = tableSize;
+
+        for (int i = size - 1; i >= 0; --i)
+        {
+            int frequency = frequencies[bytes[i]];
+            int bitsCount = tableLog - getHighBit(frequency);
+            if ((state >> bitsCount) < (unsigned int)frequency)
+            {
+                --bitsCount;
+            }
+
+            emitted[i] = ((state & ((1U << bitsCount) - 1)) << 4) | bitsCount;
+            state = stateTable[cumulative[bytes[i]] + (state >> bitsCount) - frequency];
+        }
+
+        bitWriter.Write(size, 32);
+        writeSymbolValues(tableValues, 4, bitWriter);
+        bitWriter.Write(state - tableSize, tableLog);
+
+        for (int i = 0; i < size; ++i)
+        {
+            bitWriter.Write(emitted[i] >> 4, emitted[i] & 15);
+
+            if ((i & 0xFFF) == 0)
+            {
+                flushBytes(bytesToWrite, fileWriter, writeBlockSize);
+            }
+        }
+    }
+
+    bool decodeBlock(BitReader& bitReader, std::vector<unsigned char>& out, FileWriter* fileWriter)
+    {
+        unsigned int size = bitReader.Read(32);
+        int frequencies[256];
+        int sum = 0;
+
+        readSymbolValues(bitReader, 4, frequencies);
+        for (int byte = 0; byte < 256; ++byte)
+        {
+            frequencies[byte] += 1;
+            sum += frequencies[byte];
+        }
+
+        if (sum != tableSize)
+        {
+            return false;
+        }
+
+        unsigned char symbols[tableSize];
+        DecodeEntry table[tableSize];
+        int next[256];
+
+        spreadSymbols(frequencies, symbols);
+        std::copy(frequencies, frequencies + 256, next);
+
+        for (int position = 0; position < tableSize; ++position)
+        {
+            int x = next[symbols[position]]++;
+            int bitsCount = tableLog - getHighBit(x);
+
+            table[position].symbol = symbols[position];
+            table[position].bitsCount = (unsigned char)bitsCount;
+            table[position].newStateBase = (unsigned short)((x << bitsCount) - tableSize);
+        }
+
+        unsigned int state = bitReader.Read(tableLog);
+        for (unsigned int i = 0; i < size; ++i)
+        {
+            DecodeEntry& entry = table[state];
+            if (entry.bitsCount > bitReader.GetBitsLeft())
+            {
+                return false;
+            }
+
+            STATS_ADD(tokens, 1);
+            out.push_back(entry.symbol);
+            state = entry.newStateBase + (entry.bitsCount > 0 ? bitReader.Read(entry.bitsCount) : 0);
+            flushBytes(out, fileWriter, writeBlockSize);
+        }
+
+        return true;
+    }
+
+    // Codes input that is entirely in memory; with a null fileWriter the result stays in the output
+    // of bitWriter.
+    void archiveMemory(const unsigned char* bytes, size_t size, BitWriter& bitWriter, std::vector<unsigned char>& bytesToWrite, FileWriter* fileWriter)
+    {
+        for (size_t offset = 0; offset < size; offset += blockSize)
+        {
+            encodeBlock(bytes + offset, (int)std::min((size_t)blockSize, size - offset), bitWriter, bytesToWrite, fileWriter);
+        }
+
+        bitWriter.Close();
+        flushBytes(bytesToWrite, fileWriter, 0);
+    }
+
+    void dearchive(BitReader& bitReader, std::vector<unsigned char>& out, FileWriter* fileWriter)
+    {
+        while (bitReader.GetBitsLeft() >= 32 && decodeBlock(bitReader, out, fileWriter))
+        {
+        }
+
+        flushBytes(out, fileWriter, 0);
+    }
+
+public:
+    ANS(int blockSize = 64 * 1024)
+    {
+        this->blockSize = blockSize;
+    }
+
+    using Archiver::Archive;
+    using Archiver::Dearchive;
+
+    void Archive(const std::string inputFile, const std::string outFile) override
+    {
+        STATS_SCOPE(stats);
+
+        FileReader* fileReader = new FileReader(inputFile);
+        FileWriter* fileWriter = new FileWriter(outFile);
+        std::vector<unsigned char> bytesToWrite;
+        BitWriter bitWriter(&bytesToWrite);
+        const unsigned char* data = fileReader->GetData();
+
+        if (data != nullptr)
+        {
+            archiveMemory(data, fileReader->GetSize(), bitWriter, bytesToWrite, fileWriter);
+        }
+        else
+        {
+            std::vector<unsigned char> block(blockSize);
+            int readBytes;
+
+            while ((readBytes = fileReader->Read(&block, blockSize)) > 0)
+            {
+                encodeBlock(&block[0], readBytes, bitWriter, bytesToWrite, fileWriter);
+            }
+
+            bitWriter.Close();
+            flushBytes(bytesToWrite, fileWriter, 0);
+        }
+
+        delete fileReader;
+        delete fileWriter;
+    }
+
+    void Dearchive(const std::string inputFile, const std::string outFile) override
+    {
+        STATS_SCOPE(stats);
+
+        FileReader* fileReader = new FileReader(inputFile);
+        FileWriter* fileWriter = new FileWriter(outFile);
+        BitReader* bitReader = BitReader::Open(fileReader);
+        std::vector<unsigned char> dearchivedBytes;
+
+        dearchive(*bitReader, dearchivedBytes, fileWriter);
+
+        delete bitReader;
+        delete fileWriter;
+        delete fileReader;
+    }
+
+    void Archive(ByteSpan input, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        BitWriter bitWriter(&out);
+        archiveMemory(input.data, input.size, bitWriter, out, nullptr);
+    }
+
+    size_t Archive(ByteSpan input, unsigned char* out, size_t capacity) override
+    {
+        STATS_SCOPE(stats);
+
+        std::vector<unsigned char> bytesToWrite;
+        BitWriter bitWriter(out, capacity);
+
+        archiveMemory(input.data, input.size, bitWriter, bytesToWrite, nullptr);
+        return bitWriter.GetBufferSize();
+    }
+
+    void Dearchive(ByteSpan input, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        BitReader bitReader(input.data, input.size, BitReader::GetPayloadBitsCount(input.data, input.size));
+        dearchive(bitReader, out, nullptr);
+    }
+
+    void ArchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        BitWriter bitWriter(&out);
+
+        encodeBlock(bytes, (int)size, bitWriter, out, nullptr);
+        bitWriter.Close();
+    }
+
+    void DearchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        Dearchive(ByteSpan(bytes, size), out);
+    }
+
+    std::string GetDescription() override
+    {
+        return "tANS (" + std::to_string(blockSize / 1024) + " KB blocks)";
+    }
+
+    std::string GetShortName() override
+    {
+        return "ans" + std::to_string(blockSize / 1024);
+    }
+};
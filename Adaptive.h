@@ -0,0 +1,321 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+// Codes every block with the method that a quick look at the block predicts to give the smallest
+// output: stored as is, Shannon or LZ77. A block is written as its method (8 bits), raw size and
+// archived size (32 bits each) followed by the archived bytes. Blocks that do not shrink are
+// stored, so the output is never more than blockHeaderSize bytes per block larger than the input.
+class AdaptiveArchiver : public Archiver
+{
+private:
+    static const int blockHeaderSize = 9;
+    static const int sampleSize = 16 * 1024;
+    static const int lz77SamplesCount = 4;
+    static const unsigned char storedMethod = 0;
+    static const unsigned char shannonMethod = 1;
+    static const unsigned char lz77Method = 2;
+
+    int blockSize;
+    Shannon shannon;
+    LZ77Archiver lz77;
+
+    // Shannon codes come close to the order-0 entropy; the table takes up to about half a byte per
+    // present symbol on top of its fixed part.
+    long long estimateShannonSize(const ll* counts, int size)
+    {
+        int symbolsCount = 0;
+        for (int byte = 0; byte < 256; ++byte)
+        {
+            symbolsCount += counts[byte] > 0;
+        }
+
+        return (long long)(size * getEntropy(counts) / 8) + symbolsCount / 2 + 42;
+    }
+
+    // LZ77 sizes of a few samples spread over the block, scaled up to the whole block. Matches into
+    // the data before a sample are missed, so this errs on the large side. The size of the first
+    // sample is passed in, since isIncompressible has already needed it.
+    long long estimateLZ77Size(const unsigned char* bytes, int size, long long firstSampleSize, LZ77MatchFinder<>& matchFinder)
+    {
+        int samplesCount = std::max(1, std::min((int)lz77SamplesCount, size / sampleSize));
+        int step = size / samplesCount;
+        long long sampledBytes = std::min(size, (int)sampleSize);
+        long long archivedBytes = firstSampleSize;
+
+        for (int i = 1; i < samplesCount; ++i)
+        {
+            int sampleBytes = std::min((int)sampleSize, size - i * step);
+
+            archivedBytes += lz77.GetArchivedSize(bytes + i * step, sampleBytes, matchFinder);
+            sampledBytes += sampleBytes;
+        }
+
+        return sampledBytes > 0 ? archivedBytes * size / sampledBytes : 0;
+    }
+
+    // Incompressible data usually shows it from the first bytes on, so those are looked at before
+    // the whole block.
+    bool isIncompressible(const unsigned char* bytes, int size, long long lz77Size)
+    {
+        ll counts[256] = {};
+        countBytes(bytes, size, counts);
+
+        return estimateShannonSize(counts, size) >= size && lz77Size >= size;
+    }
+
+    unsigned char chooseMethod(const unsigned char* bytes, int size, LZ77MatchFinder<>& matchFinder)
+    {
+        int firstSampleBytes = std::min(size, (int)sampleSize);
+        long long firstSampleSize = lz77.GetArchivedSize(bytes, firstSampleBytes, matchFinder);
+
+        if (isIncompressible(bytes, firstSampleBytes, firstSampleSize))
+        {
+            return storedMethod;
+        }
+
+        ll counts[256] = {};
+        countBytes(bytes, size, counts);
+
+        long long shannonSize = estimateShannonSize(counts, size);
+        long long lz77Size = estimateLZ77Size(bytes, size, firstSampleSize, matchFinder);
+
+        if (size <= std::min(shannonSize, lz77Size))
+        {
+            return storedMethod;
+        }
+
+        return shannonSize <= lz77Size ? shannonMethod : lz77Method;
+    }
+
+    // Codes the block into archivedBlock and returns the method used. Stored blocks leave
+    // archivedBlock empty, their payload is the input itself. The match finder for the estimates
+    // is passed in so that one serves all the blocks of a call.
+    unsigned char encodeBlock(const unsigned char* bytes, int size, std::vector<unsigned char>& archivedBlock, LZ77MatchFinder<>& matchFinder)
+    {
+        unsigned char method = chooseMethod(bytes, size, matchFinder);
+
+        if (method == shannonMethod)
+        {
+            shannon.ArchiveBlock(bytes, size, archivedBlock);
+        }
+        else if (method == lz77Method)
+        {
+            lz77.ArchiveBlock(bytes, size, archivedBlock);
+        }
+
+        if (archivedBlock.size() >= (size_t)size)
+        {
+            archivedBlock.clear();
+            method = storedMethod;
+        }
+
+        return method;
+    }
+
+    void writeHeader(std::vector<unsigned char>& out, unsigned char method, unsigned int rawSize, unsigned int archivedSize)
+    {
+        out.push_back(method);
+        writeUInt32(out, rawSize);
+        writeUInt32(out, archivedSize);
+    }
+
+    void writeBlock(const unsigned char* bytes, int size, std::vector<unsigned char>& archivedBlock, std::vector<unsigned char>& header, LZ77MatchFinder<>& matchFinder, FileWriter* fileWriter)
+    {
+        archivedBlock.clear();
+        header.clear();
+
+        unsigned char method = encodeBlock(bytes, size, archivedBlock, matchFinder);
+        const unsigned char* payload = method == storedMethod ? bytes : &archivedBlock[0];
+        size_t payloadSize = method == storedMethod ? size : archivedBlock.size();
+
+        writeHeader(header, method, size, payloadSize);
+        fileWriter->Write(&header);
+        fileWriter->Write(payload, payloadSize);
+    }
+
+    void dearchiveBlock(unsigned char method, const unsigned char* bytes, size_t size, std::vector<unsigned char>& out)
+    {
+        if (method == shannonMethod)
+        {
+            shannon.DearchiveBlock(bytes, size, out);
+        }
+        else if (method == lz77Method)
+        {
+            lz77.DearchiveBlock(bytes, size, out);
+        }
+        else if (method == storedMethod)
+        {
+            out.insert(out.end(), bytes, bytes + size);
+        }
+    }
+
+    // Decodes the blocks of an archive held in memory.
+    void dearchive(const unsigned char* data, size_t size, std::vector<unsigned char>& out, FileWriter* fileWriter)
+    {
+        size_t offset = 0;
+
+        while (offset + blockHeaderSize <= size)
+        {
+            unsigned int archivedSize = readUInt32(data + offset + 5);
+            if (offset + blockHeaderSize + archivedSize > size)
+            {
+                break;
+            }
+
+            if (data[offset] == storedMethod && fileWriter != nullptr)
+            {
+                fileWriter->Write(data + offset + blockHeaderSize, archivedSize);
+            }
+            else
+            {
+                dearchiveBlock(data[offset], data + offset + blockHeaderSize, archivedSize, out);
+            }
+
+            offset += blockHeaderSize + archivedSize;
+
+            if (fileWriter != nullptr && out.size() > 0)
+            {
+                fileWriter->Write(&out);
+                out.clear();
+            }
+        }
+    }
+
+public:
+    AdaptiveArchiver(int blockSize = 256 * 1024, int historySize = 16 * 1024, int viewSize = 4 * 1024) : lz77(historySize, viewSize)
+    {
+        this->blockSize = blockSize;
+    }
+
+    using Archiver::Archive;
+    using Archiver::Dearchive;
+
+    void Archive(const std::string inputFile, const std::string outFile) override
+    {
+        STATS_SCOPE(stats);
+
+        FileReader* fileReader = new FileReader(inputFile);
+        FileWriter* fileWriter = new FileWriter(outFile);
+        const unsigned char* data = fileReader->GetData();
+        std::vector<unsigned char> archivedBlock;
+        std::vector<unsigned char> header;
+        LZ77MatchFinder<> matchFinder = lz77.CreateMatchFinder();
+
+        if (data != nullptr)
+        {
+            for (long long offset = 0; offset < fileReader->GetSize(); offset += blockSize)
+            {
+                int size = (int)std::min((long long)blockSize, fileReader->GetSize() - offset);
+                writeBlock(data + offset, size, archivedBlock, header, matchFinder, fileWriter);
+            }
+        }
+        else
+        {
+            // The size of a pipe is not known up front, so it is read until it ends.
+            std::vector<unsigned char> block(blockSize);
+            int readBytes;
+
+            while ((readBytes = fileReader->Read(&block, blockSize)) > 0)
+            {
+                writeBlock(&block[0], readBytes, archivedBlock, header, matchFinder, fileWriter);
+            }
+        }
+
+        delete fileReader;
+        delete fileWriter;
+    }
+
+    void Dearchive(const std::string inputFile, const std::string outFile) override
+    {
+        STATS_SCOPE(stats);
+
+        FileReader* fileReader = new FileReader(inputFile);
+        FileWriter* fileWriter = new FileWriter(outFile);
+        std::vector<unsigned char> block;
+
+        if (fileReader->GetData() != nullptr)
+        {
+            dearchive(fileReader->GetData(), fileReader->GetSize(), block, fileWriter);
+        }
+        else
+        {
+            std::vector<unsigned char> header(blockHeaderSize);
+            std::vector<unsigned char> archivedBlock;
+
+            while (fileReader->Read(&header, blockHeaderSize) == blockHeaderSize)
+            {
+                unsigned int archivedSize = readUInt32(&header[5]);
+                archivedBlock.resize(archivedSize + 1);
+
+                if (fileReader->Read(&archivedBlock[0], archivedSize) != (int)archivedSize)
+                {
+                    break;
+                }
+
+                block.clear();
+                dearchiveBlock(header[0], &archivedBlock[0], archivedSize, block);
+                if (block.size() > 0)
+                {
+                    fileWriter->Write(&block);
+                }
+            }
+        }
+
+        delete fileWriter;
+        delete fileReader;
+    }
+
+    void Archive(ByteSpan input, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        std::vector<unsigned char> archivedBlock;
+        LZ77MatchFinder<> matchFinder = lz77.CreateMatchFinder();
+
+        for (size_t offset = 0; offset < input.size; offset += blockSize)
+        {
+            const unsigned char* bytes = input.data + offset;
+            int size = (int)std::min((size_t)blockSize, input.size - offset);
+
+            archivedBlock.clear();
+            unsigned char method = encodeBlock(bytes, size, archivedBlock, matchFinder);
+            const unsigned char* payload = method == storedMethod ? bytes : &archivedBlock[0];
+            size_t payloadSize = method == storedMethod ? size : archivedBlock.size();
+
+            writeHeader(out, method, size, payloadSize);
+            out.insert(out.end(), payload, payload + payloadSize);
+        }
+    }
+
+    void Dearchive(ByteSpan input, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        dearchive(input.data, input.size, out, nullptr);
+    }
+
+    void ArchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        Archive(ByteSpan(bytes, size), out);
+    }
+
+    void DearchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        Dearchive(ByteSpan(bytes, size), out);
+    }
+
+    std::string GetDescription() override
+    {
+        return "Adaptive (stored, Shannon or LZ77 per " + std::to_string(blockSize / 1024) + " KB block)";
+    }
+
+    std::string GetShortName() override
+    {
+        return "adapt";
+    }
+};
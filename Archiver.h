@@ -1,10 +1,249 @@
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+// Non-owning view of contiguous input bytes.
+struct ByteSpan
+{
+public:
+    const unsigned char* data;
+    size_t size;
+
+    ByteSpan(const unsigned char* data, size_t size) : data(data), size(size) {}
+    ByteSpan(const std::vector<unsigned char>& bytes) : data(bytes.empty() ? nullptr : &bytes[0]), size(bytes.size()) {}
+};
+
+// Counters for the hot paths of the archivers. They are only collected in builds with
+// ARCHIVER_STATS defined; otherwise the STATS_ macros expand to nothing and all counters stay 0.
+struct ArchiverStats
+{
+public:
+    unsigned long long matchProbes;
+    unsigned long long bytesCompared;
+    unsigned long long tokens;
+    unsigned long long matches;
+    unsigned long long matchedBytes;
+    unsigned long long bitsWritten;
+    unsigned long long bitsRead;
+    unsigned long long readCalls;
+    unsigned long long writeCalls;
+    // Time spent in Archive/Dearchive calls, summed over the threads that worked on them, and the
+    // parts of it spent in the parse loops of the LZ coders and in file reads and writes. A parse
+    // loop is timed as a whole, file reads and writes made from it included, so that the per-token
+    // path only updates counters.
+    double seconds;
+    double parseSeconds;
+    double ioSeconds;
+
+    ArchiverStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        matchProbes = bytesCompared = tokens = matches = matchedBytes = 0;
+        bitsWritten = bitsRead = readCalls = writeCalls = 0;
+        seconds = parseSeconds = ioSeconds = 0;
+    }
+
+    void Add(const ArchiverStats& other)
+    {
+        matchProbes += other.matchProbes;
+        bytesCompared += other.bytesCompared;
+        tokens += other.tokens;
+        matches += other.matches;
+        matchedBytes += other.matchedBytes;
+        bitsWritten += other.bitsWritten;
+        bitsRead += other.bitsRead;
+        readCalls += other.readCalls;
+        writeCalls += other.writeCalls;
+        seconds += other.seconds;
+        parseSeconds += other.parseSeconds;
+        ioSeconds += other.ioSeconds;
+    }
+
+    double GetAverageMatchLength() const
+    {
+        return matches > 0 ? (double)matchedBytes / matches : 0;
+    }
+
+    // Counters of the call being made on this thread, or nullptr outside of one.
+    static ArchiverStats*& Current()
+    {
+        static thread_local ArchiverStats* current = nullptr;
+        return current;
+    }
+
+    static std::mutex& GetMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+};
+
+// Counts one call into target. Calls made from within another one, such as an archiver
+// coding its blocks with a second archiver, count towards the outermost call.
+class ArchiverStatsScope
+{
+private:
+    ArchiverStats* target;
+    ArchiverStats local;
+    bool outermost;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    ArchiverStatsScope(ArchiverStats& target) : target(&target), outermost(ArchiverStats::Current() == nullptr)
+    {
+        if (outermost)
+        {
+            ArchiverStats::Current() = &local;
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~ArchiverStatsScope()
+    {
+        if (outermost)
+        {
+            local.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            ArchiverStats::Current() = nullptr;
+
+            std::unique_lock<std::mutex> lock(ArchiverStats::GetMutex());
+            target->Add(local);
+        }
+    }
+};
+
+// Adds the time until the end of the enclosing block to one of the phase times.
+class ArchiverStatsTimer
+{
+private:
+    double* seconds;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    ArchiverStatsTimer(double ArchiverStats::* phase) : seconds(ArchiverStats::Current() != nullptr ? &(ArchiverStats::Current()->*phase) : nullptr)
+    {
+        if (seconds != nullptr)
+        {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~ArchiverStatsTimer()
+    {
+        if (seconds != nullptr)
+        {
+            *seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+};
+
+#ifdef ARCHIVER_STATS
+#define STATS_ADD(counter, value) do { if (ArchiverStats::Current() != nullptr) ArchiverStats::Current()->counter += (value); } while (0)
+#define STATS_TIMER(phase) ArchiverStatsTimer statsTimer(&ArchiverStats::phase)
+#define STATS_SCOPE(target) ArchiverStatsScope statsScope(target)
+#else
+#define STATS_ADD(counter, value) do {} while (0)
+#define STATS_TIMER(phase) do {} while (0)
+#define STATS_SCOPE(target) do {} while (0)
+#endif
+
+// Incremental coder that is fed the input in chunks as they arrive. Update codes what it can and
+// appends the result to out; Flush also codes everything buffered so far; Finish ends the stream.
+class ArchiverStream
+{
+public:
+    virtual void Update(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) = 0;
+    virtual void Flush(std::vector<unsigned char>& out) = 0;
+    virtual void Finish(std::vector<unsigned char>& out) = 0;
+
+    virtual ~ArchiverStream() {}
+};
 
 class Archiver 
 {
 public:
     virtual void Archive(const std::string inputFile, const std::string outFile) = 0;
     virtual void Dearchive(const std::string inputFile, const std::string outFile) = 0;
+
+    // In-memory versions of Archive/Dearchive. They append to out exactly the bytes the file
+    // versions would write, so buffers and files can be mixed freely.
+    virtual void Archive(ByteSpan input, std::vector<unsigned char>& out) = 0;
+    virtual void Dearchive(ByteSpan input, std::vector<unsigned char>& out) = 0;
+
+    // Write into a caller-provided buffer instead. Return the size of the whole result, which was
+    // only written if it is not larger than capacity; otherwise the call can be repeated with a
+    // buffer of that size.
+    virtual size_t Archive(ByteSpan input, unsigned char* out, size_t capacity)
+    {
+        std::vector<unsigned char> bytes;
+        Archive(input, bytes);
+        return copyToBuffer(bytes, out, capacity);
+    }
+
+    virtual size_t Dearchive(ByteSpan input, unsigned char* out, size_t capacity)
+    {
+        std::vector<unsigned char> bytes;
+        Dearchive(input, bytes);
+        return copyToBuffer(bytes, out, capacity);
+    }
+
+    // Code one self-contained block held in memory and append the result to out.
+    // Implementations keep no state between calls, so one instance may serve several threads.
+    virtual void ArchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) = 0;
+    virtual void DearchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) = 0;
+
+    // Append length bytes of the original data starting at offset to out, fewer if the data ends
+    // first. Only formats with a block index can do this without decoding the whole archive; this
+    // fallback decodes all of it from the mapped file, or from a copy in memory where the file
+    // cannot be mapped, which costs O(archive + data) memory.
+    // Returns false if the archive cannot be read or offset is outside of the data.
+    virtual bool ExtractRange(const std::string inputFile, long long offset, long long length, std::vector<unsigned char>& out);
+
+    // Stream versions of Archive/Dearchive. The caller deletes the returned object before the
+    // archiver; formats that cannot be coded incrementally return nullptr.
+    virtual ArchiverStream* CreateArchiveStream()
+    {
+        return nullptr;
+    }
+
+    virtual ArchiverStream* CreateDearchiveStream()
+    {
+        return nullptr;
+    }
+
     virtual std::string GetDescription() = 0;
     virtual std::string GetShortName() = 0;
+
+    // Counters summed over the calls made since the last ResetStats; all 0 unless ARCHIVER_STATS
+    // is defined.
+    ArchiverStats GetStats()
+    {
+        std::unique_lock<std::mutex> lock(ArchiverStats::GetMutex());
+        return stats;
+    }
+
+    void ResetStats()
+    {
+        std::unique_lock<std::mutex> lock(ArchiverStats::GetMutex());
+        stats.Reset();
+    }
+
+protected:
+    ArchiverStats stats;
+
+private:
+    size_t copyToBuffer(std::vector<unsigned char>& bytes, unsigned char* out, size_t capacity)
+    {
+        if (bytes.size() <= capacity)
+        {
+            std::copy(bytes.begin(), bytes.end(), out);
+        }
+
+        return bytes.size();
+    }
 };
\ No newline at end of file
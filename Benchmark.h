@@ -0,0 +1,383 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+#include <csignal>
+#include <filesystem>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/stat.h>
+#endif
+
+struct BenchmarkResult
+{
+public:
+    std::string fileName;
+    std::string archiverName;
+    long long rawSize;
+    long long archivedSize;
+    double entropy;
+    std::vector<double> archiveTimes;
+    std::vector<double> dearchiveTimes;
+    long long peakMemory;
+    bool verified;
+    ArchiverStats stats;
+
+    BenchmarkResult() : rawSize(0), archivedSize(0), entropy(0), peakMemory(0), verified(false) {}
+};
+
+// Times Archive and Dearchive of files on disk: warmupRuns unmeasured runs, then runs measured
+// ones. Work files are written next to the input and removed afterwards.
+class Benchmark
+{
+private:
+    int runs;
+    int warmupRuns;
+
+    static double getSeconds(std::chrono::steady_clock::duration duration)
+    {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+    static double getPercentile(std::vector<double> times, double percentile)
+    {
+        if (times.empty())
+        {
+            return 0;
+        }
+
+        std::sort(times.begin(), times.end());
+        size_t index = (size_t)(percentile / 100 * (times.size() - 1) + 0.5);
+        return times[std::min(index, times.size() - 1)];
+    }
+
+    static double getSpeed(long long size, double seconds)
+    {
+        return seconds > 0 ? size / seconds / 1000000 : 0;
+    }
+
+    // Peak resident memory is only tracked per process, so on Linux the high-water mark is reset
+    // before every archiver; elsewhere the value is the peak of the whole run so far.
+    static void resetPeakMemory()
+    {
+#ifdef __linux__
+        std::ofstream clearRefs("/proc/self/clear_refs");
+        clearRefs << "5";
+#endif
+    }
+
+    static long long getPeakMemory()
+    {
+#ifdef __linux__
+        std::ifstream status("/proc/self/status");
+        std::string line;
+
+        while (std::getline(status, line))
+        {
+            if (line.compare(0, 6, "VmHWM:") == 0)
+            {
+                return std::stoll(line.substr(6)) * 1024;
+            }
+        }
+#endif
+#ifndef _WIN32
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss;
+#else
+        return usage.ru_maxrss * 1024LL;
+#endif
+#else
+        return 0;
+#endif
+    }
+
+    static bool compareFiles(const std::string firstFile, const std::string secondFile)
+    {
+        FileReader firstReader(firstFile);
+        FileReader secondReader(secondFile);
+
+        if (firstReader.GetSize() != secondReader.GetSize())
+        {
+            return false;
+        }
+
+        const int blockSize = 1024 * 1024;
+        std::vector<unsigned char> firstBlock(blockSize);
+        std::vector<unsigned char> secondBlock(blockSize);
+        int readBytes;
+
+        while ((readBytes = firstReader.Read(&firstBlock, blockSize)) > 0)
+        {
+            if (secondReader.Read(&secondBlock, blockSize) != readBytes || std::memcmp(&firstBlock[0], &secondBlock[0], readBytes) != 0)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Sends the input through the stream versions of the archiver in chunks, each followed by a
+    // Flush, and checks that every chunk can be decoded in full as soon as it has been flushed.
+    static bool verifyStreams(Archiver* archiver, const std::string inputFile)
+    {
+        ArchiverStream* archiveStream = archiver->CreateArchiveStream();
+        ArchiverStream* dearchiveStream = archiver->CreateDearchiveStream();
+        bool verified = true;
+
+        if (archiveStream != nullptr && dearchiveStream != nullptr)
+        {
+            // Not a multiple of any block size, so that the flushes cut blocks short.
+            const int chunkSize = 100 * 1000;
+            FileReader fileReader(inputFile);
+            std::vector<unsigned char> chunk(chunkSize);
+            std::vector<unsigned char> archived;
+            std::vector<unsigned char> dearchived;
+            int readBytes;
+
+            while (verified && (readBytes = fileReader.Read(&chunk, chunkSize)) > 0)
+            {
+                archived.clear();
+                dearchived.clear();
+                archiveStream->Update(&chunk[0], readBytes, archived);
+                archiveStream->Flush(archived);
+                dearchiveStream->Update(archived.data(), archived.size(), dearchived);
+
+                verified = dearchived.size() == (size_t)readBytes && std::memcmp(&chunk[0], dearchived.data(), readBytes) == 0;
+            }
+
+            if (verified)
+            {
+                archived.clear();
+                dearchived.clear();
+                archiveStream->Finish(archived);
+                dearchiveStream->Update(archived.data(), archived.size(), dearchived);
+                dearchiveStream->Finish(dearchived);
+
+                verified = dearchived.empty();
+            }
+        }
+
+        delete archiveStream;
+        delete dearchiveStream;
+        return verified;
+    }
+
+    // Archives the input once more, read from a pipe, and checks that it dearchives to the input:
+    // archivers that read their input twice must not lose what a pipe only gives once.
+    static bool verifyPipe(Archiver* archiver, const std::string inputFile, const std::string archivedFile, const std::string dearchivedFile)
+    {
+#ifndef _WIN32
+        std::string pipeFile = archivedFile + ".pipe";
+        std::remove(pipeFile.c_str());
+        if (mkfifo(pipeFile.c_str(), 0600) != 0)
+        {
+            return true;
+        }
+
+        // An archiver that stops reading early closes the pipe on the writer, which must then
+        // fail its write instead of ending the process.
+        std::signal(SIGPIPE, SIG_IGN);
+        std::thread writer([&]()
+        {
+            std::ifstream input(inputFile, std::ios::binary);
+            std::ofstream pipe(pipeFile, std::ios::binary);
+            pipe << input.rdbuf();
+        });
+
+        archiver->Archive(pipeFile, archivedFile);
+        writer.join();
+        archiver->Dearchive(archivedFile, dearchivedFile);
+        std::remove(pipeFile.c_str());
+
+        return compareFiles(inputFile, dearchivedFile);
+#else
+        return true;
+#endif
+    }
+
+    static std::string escapeJson(const std::string& value)
+    {
+        std::string escaped;
+
+        for (char c : value)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+            }
+
+            escaped += c;
+        }
+
+        return escaped;
+    }
+
+public:
+    Benchmark(int runs = 5, int warmupRuns = 1)
+    {
+        this->runs = std::max(runs, 1);
+        this->warmupRuns = std::max(warmupRuns, 0);
+    }
+
+    BenchmarkResult Run(Archiver* archiver, const std::string inputFile)
+    {
+        // The work files go to the temporary directory so that the corpus directory stays untouched.
+        BenchmarkResult result;
+        std::string workFile = (std::filesystem::temp_directory_path() / std::filesystem::path(inputFile).filename()).string();
+        std::string archivedFile = workFile + "." + archiver->GetShortName();
+        std::string dearchivedFile = workFile + ".un" + archiver->GetShortName();
+
+        FileReader* fileReader = new FileReader(inputFile);
+        unsigned long long counts[256] = {};
+        countBytes(fileReader, counts);
+
+        result.fileName = inputFile;
+        result.archiverName = archiver->GetShortName();
+        result.rawSize = fileReader->GetSize();
+        result.entropy = getEntropy(counts);
+        delete fileReader;
+
+        resetPeakMemory();
+        for (int i = 0; i < warmupRuns + runs; ++i)
+        {
+            if (i == warmupRuns)
+            {
+                archiver->ResetStats();
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            archiver->Archive(inputFile, archivedFile);
+            auto middle = std::chrono::steady_clock::now();
+            archiver->Dearchive(archivedFile, dearchivedFile);
+            auto end = std::chrono::steady_clock::now();
+
+            if (i >= warmupRuns)
+            {
+                result.archiveTimes.push_back(getSeconds(middle - start));
+                result.dearchiveTimes.push_back(getSeconds(end - middle));
+            }
+        }
+
+        result.peakMemory = getPeakMemory();
+        result.stats = archiver->GetStats();
+        result.verified = compareFiles(inputFile, dearchivedFile) && verifyStreams(archiver, inputFile);
+
+        FileReader archivedReader(archivedFile);
+        result.archivedSize = archivedReader.GetSize();
+        result.verified = result.verified && verifyPipe(archiver, inputFile, archivedFile, dearchivedFile);
+
+        std::remove(archivedFile.c_str());
+        std::remove(dearchivedFile.c_str());
+
+        return result;
+    }
+
+    static void PrintResult(std::ostream& out, const BenchmarkResult& result)
+    {
+        char line[256];
+
+        std::snprintf(line, sizeof(line), "%-10s %12lld %12lld %7.3f %9.1f %9.1f %9.1f %9.1f %9.1f %s",
+            result.archiverName.c_str(), result.rawSize, result.archivedSize,
+            result.rawSize > 0 ? (double)result.archivedSize / result.rawSize : 0,
+            getSpeed(result.rawSize, getPercentile(result.archiveTimes, 50)), getSpeed(result.rawSize, getPercentile(result.archiveTimes, 99)),
+            getSpeed(result.rawSize, getPercentile(result.dearchiveTimes, 50)), getSpeed(result.rawSize, getPercentile(result.dearchiveTimes, 99)),
+            result.peakMemory / 1048576.0, result.verified ? "ok" : "MISMATCH");
+
+        out << line << "\n";
+
+#ifdef ARCHIVER_STATS
+        const ArchiverStats& stats = result.stats;
+
+        std::snprintf(line, sizeof(line), "  probes %llu, compared %llu B, tokens %llu, avg match %.1f, bits out %llu, bits in %llu, "
+            "reads %llu, writes %llu, time %.3fs (parse %.3fs, io %.3fs)",
+            stats.matchProbes, stats.bytesCompared, stats.tokens, stats.GetAverageMatchLength(), stats.bitsWritten, stats.bitsRead,
+            stats.readCalls, stats.writeCalls, stats.seconds, stats.parseSeconds, stats.ioSeconds);
+
+        out << line << "\n";
+#endif
+    }
+
+    static void PrintHeader(std::ostream& out)
+    {
+        char line[256];
+
+        std::snprintf(line, sizeof(line), "%-10s %12s %12s %7s %9s %9s %9s %9s %9s %s",
+            "archiver", "raw", "archived", "ratio", "enc MB/s", "enc p99", "dec MB/s", "dec p99", "peak MB", "check");
+
+        out << line << "\n";
+    }
+
+    // Throughput and memory against input size: one line per archiver and input, grouped by archiver
+    // and in input order within a group.
+    static void PrintCurves(std::ostream& out, std::vector<BenchmarkResult> results)
+    {
+        std::stable_sort(results.begin(), results.end(), [](const BenchmarkResult& first, const BenchmarkResult& second)
+        {
+            return first.archiverName < second.archiverName;
+        });
+
+        for (const BenchmarkResult& result : results)
+        {
+            char line[512];
+
+            std::snprintf(line, sizeof(line), "%-10s %-40s %12lld %9.1f %9.1f %9.1f",
+                result.archiverName.c_str(), result.fileName.c_str(), result.rawSize,
+                getSpeed(result.rawSize, getPercentile(result.archiveTimes, 50)),
+                getSpeed(result.rawSize, getPercentile(result.dearchiveTimes, 50)), result.peakMemory / 1048576.0);
+
+            out << line << "\n";
+        }
+    }
+
+    // Speeds are computed from the median and the 99th percentile run times.
+    static void WriteCsv(const std::string fileName, const std::vector<BenchmarkResult>& results)
+    {
+        std::ofstream out(fileName);
+
+        out << "file,archiver,raw_size,archived_size,ratio,entropy,archive_mbps_median,archive_mbps_p99,"
+               "dearchive_mbps_median,dearchive_mbps_p99,peak_rss_bytes,verified\n";
+
+        for (const BenchmarkResult& result : results)
+        {
+            out << result.fileName << "," << result.archiverName << "," << result.rawSize << "," << result.archivedSize << ","
+                << (result.rawSize > 0 ? (double)result.archivedSize / result.rawSize : 0) << "," << result.entropy << ","
+                << getSpeed(result.rawSize, getPercentile(result.archiveTimes, 50)) << ","
+                << getSpeed(result.rawSize, getPercentile(result.archiveTimes, 99)) << ","
+                << getSpeed(result.rawSize, getPercentile(result.dearchiveTimes, 50)) << ","
+                << getSpeed(result.rawSize, getPercentile(result.dearchiveTimes, 99)) << ","
+                << result.peakMemory << "," << (result.verified ? 1 : 0) << "\n";
+        }
+    }
+
+    static void WriteJson(const std::string fileName, const std::vector<BenchmarkResult>& results)
+    {
+        std::ofstream out(fileName);
+
+        out << "[\n";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const BenchmarkResult& result = results[i];
+
+            out << "  {\"file\": \"" << escapeJson(result.fileName) << "\", \"archiver\": \"" << escapeJson(result.archiverName) << "\""
+                << ", \"raw_size\": " << result.rawSize << ", \"archived_size\": " << result.archivedSize
+                << ", \"ratio\": " << (result.rawSize > 0 ? (double)result.archivedSize / result.rawSize : 0)
+                << ", \"entropy\": " << result.entropy
+                << ", \"archive_mbps_median\": " << getSpeed(result.rawSize, getPercentile(result.archiveTimes, 50))
+                << ", \"archive_mbps_p99\": " << getSpeed(result.rawSize, getPercentile(result.archiveTimes, 99))
+                << ", \"dearchive_mbps_median\": " << getSpeed(result.rawSize, getPercentile(result.dearchiveTimes, 50))
+                << ", \"dearchive_mbps_p99\": " << getSpeed(result.rawSize, getPercentile(result.dearchiveTimes, 99))
+                << ", \"peak_rss_bytes\": " << result.peakMemory
+                << ", \"verified\": " << (result.verified ? "true" : "false") << "}"
+                << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "]\n";
+    }
+};
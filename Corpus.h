@@ -0,0 +1,232 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+// Deterministic synthetic inputs for scaling benchmarks. The same kind, size and seed always give
+// the same bytes on every platform, and files are written in chunks, so sizes of several GB need
+// no more memory than small ones. Kinds, from low to high entropy: "repetitive" (records drawn
+// from a small pool), "bmp" (24-bit gradient image with slight noise), "text" (words with
+// Zipf-like frequencies) and "random".
+class CorpusGenerator
+{
+private:
+    static const int chunkSize = 1024 * 1024;
+    static const int recordsCount = 256;
+    static const int wordsCount = 1024;
+    static const int bmpWidth = 1024;
+    static const int bmpHeaderSize = 54;
+
+    unsigned long long seed;
+    unsigned long long state;
+    std::vector<std::string> words;
+    std::vector<std::string> records;
+
+    unsigned long long next()
+    {
+        unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    int nextInt(int bound)
+    {
+        return (int)(next() % bound);
+    }
+
+    // Index in [0, bound) where small indices are much more likely, like word ranks in a language.
+    int nextSkewed(int bound)
+    {
+        double r = (next() >> 11) * (1.0 / 9007199254740992.0);
+        return std::min((int)(bound * r * r * r), bound - 1);
+    }
+
+    void reset(const std::string& kind)
+    {
+        state = seed;
+        for (char c : kind)
+        {
+            state = state * 31 + (unsigned char)c;
+        }
+
+        const char* syllables[] = {"ka", "lo", "me", "ri", "su", "ta", "ne", "vo", "di", "an", "el", "or", "is", "un", "ch", "th"};
+        words.clear();
+        for (int i = 0; i < wordsCount; ++i)
+        {
+            std::string word;
+            for (int j = 1 + nextInt(4); j > 0; --j)
+            {
+                word += syllables[nextInt(16)];
+            }
+            words.push_back(word);
+        }
+
+        records.clear();
+        for (int i = 0; i < recordsCount; ++i)
+        {
+            std::string record;
+            for (int j = 16 + nextInt(240); j > 0; --j)
+            {
+                record += (char)('A' + nextInt(40));
+            }
+            records.push_back(record);
+        }
+    }
+
+    void appendText(std::vector<unsigned char>& bytes, long long& lineLength)
+    {
+        const std::string& word = words[nextSkewed(wordsCount)];
+        bytes.insert(bytes.end(), word.begin(), word.end());
+        lineLength += word.size() + 1;
+
+        int punctuation = nextInt(16);
+        if (punctuation == 0)
+        {
+            bytes.push_back('.');
+        }
+        else if (punctuation == 1)
+        {
+            bytes.push_back(',');
+        }
+
+        if (lineLength > 72)
+        {
+            bytes.push_back('\n');
+            lineLength = 0;
+        }
+        else
+        {
+            bytes.push_back(' ');
+        }
+    }
+
+    void appendRecord(std::vector<unsigned char>& bytes)
+    {
+        const std::string& record = records[nextSkewed(recordsCount)];
+        bytes.insert(bytes.end(), record.begin(), record.end());
+
+        if (nextInt(8) == 0)
+        {
+            bytes.push_back((unsigned char)next());
+        }
+    }
+
+    void appendRandom(std::vector<unsigned char>& bytes)
+    {
+        unsigned long long value = next();
+        for (int i = 0; i < 8; ++i)
+        {
+            bytes.push_back((unsigned char)(value >> (8 * i)));
+        }
+    }
+
+    void appendLittleEndian(std::vector<unsigned char>& bytes, unsigned int value, int size)
+    {
+        for (int i = 0; i < size; ++i)
+        {
+            bytes.push_back((unsigned char)(value >> (8 * i)));
+        }
+    }
+
+    // The header announces as many rows as are needed to reach size; the last one may be cut short.
+    void appendBmpHeader(std::vector<unsigned char>& bytes, long long size)
+    {
+        const int rowSize = bmpWidth * 3;
+        long long height = std::max(1LL, (size - bmpHeaderSize + rowSize - 1) / rowSize);
+
+        bytes.push_back('B');
+        bytes.push_back('M');
+        appendLittleEndian(bytes, (unsigned int)(bmpHeaderSize + height * rowSize), 4);
+        appendLittleEndian(bytes, 0, 4);
+        appendLittleEndian(bytes, bmpHeaderSize, 4);
+        appendLittleEndian(bytes, 40, 4);
+        appendLittleEndian(bytes, bmpWidth, 4);
+        appendLittleEndian(bytes, (unsigned int)height, 4);
+        appendLittleEndian(bytes, 1, 2);
+        appendLittleEndian(bytes, 24, 2);
+        appendLittleEndian(bytes, 0, 4);
+        appendLittleEndian(bytes, (unsigned int)(height * rowSize), 4);
+        appendLittleEndian(bytes, 2835, 4);
+        appendLittleEndian(bytes, 2835, 4);
+        appendLittleEndian(bytes, 0, 4);
+        appendLittleEndian(bytes, 0, 4);
+    }
+
+    void appendBmpRow(std::vector<unsigned char>& bytes, long long row)
+    {
+        for (int x = 0; x < bmpWidth; ++x)
+        {
+            int noise = nextInt(5) - 2;
+            bytes.push_back((unsigned char)(x * 255 / bmpWidth + noise));
+            bytes.push_back((unsigned char)((row * 255 / 4096) + noise));
+            bytes.push_back((unsigned char)((x + row) / 8 + noise));
+        }
+    }
+
+    // Appends the next piece of the input; index counts the pieces appended so far.
+    void append(const std::string& kind, long long index, long long size, std::vector<unsigned char>& bytes, long long& lineLength)
+    {
+        if (kind == "text")
+        {
+            appendText(bytes, lineLength);
+        }
+        else if (kind == "repetitive")
+        {
+            appendRecord(bytes);
+        }
+        else if (kind == "bmp")
+        {
+            if (index == 0)
+            {
+                appendBmpHeader(bytes, size);
+            }
+            else
+            {
+                appendBmpRow(bytes, index - 1);
+            }
+        }
+        else
+        {
+            appendRandom(bytes);
+        }
+    }
+
+public:
+    CorpusGenerator(unsigned long long seed = 1)
+    {
+        this->seed = seed;
+        this->state = seed;
+    }
+
+    static bool IsKind(const std::string kind)
+    {
+        return kind == "text" || kind == "repetitive" || kind == "random" || kind == "bmp";
+    }
+
+    // Writes exactly size bytes of the given kind to outFile.
+    void Generate(const std::string kind, long long size, const std::string outFile)
+    {
+        FileWriter* fileWriter = new FileWriter(outFile);
+        std::vector<unsigned char> bytes;
+        long long written = 0;
+        long long index = 0;
+        long long lineLength = 0;
+
+        reset(kind);
+        while (written < size)
+        {
+            while ((long long)bytes.size() < chunkSize && written + (long long)bytes.size() < size)
+            {
+                append(kind, index++, size, bytes, lineLength);
+            }
+
+            size_t count = (size_t)std::min((long long)bytes.size(), size - written);
+            fileWriter->Write(&bytes[0], count);
+            written += count;
+            bytes.erase(bytes.begin(), bytes.begin() + count);
+        }
+
+        delete fileWriter;
+    }
+};
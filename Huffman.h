@@ -0,0 +1,121 @@
+#include <iostream>
+#include <vector>
+#include <queue>
+#include <algorithm>
+
+// Same archive format, modes and streams as Shannon, with code lengths taken from a Huffman tree
+// instead of the Shannon-Fano split.
+class Huffman : public Shannon
+{
+private:
+    // Short enough for every code to be decoded with a single lookup in the primary table.
+    static const int maxCodeLength = 11;
+
+    // Lengths come ordered from the rarest symbol to the most frequent one. Brings every length down
+    // to maxCodeLength, then lengthens the rarest of the codes that are still shorter until the
+    // lengths describe a prefix code again, and finally hands any room left to the frequent symbols.
+    void limitLengths(std::vector<int>& lengths)
+    {
+        int n = lengths.size();
+        ll capacity = 1LL << maxCodeLength;
+        ll kraftSum = 0;
+
+        for (int i = 0; i < n; ++i)
+        {
+            lengths[i] = std::min(lengths[i], (int)maxCodeLength);
+            kraftSum += 1LL << (maxCodeLength - lengths[i]);
+        }
+
+        while (kraftSum > capacity)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                if (lengths[i] < maxCodeLength)
+                {
+                    kraftSum -= 1LL << (maxCodeLength - lengths[i] - 1);
+                    ++lengths[i];
+                    break;
+                }
+            }
+        }
+
+        for (int i = n - 1; i >= 0; --i)
+        {
+            while (lengths[i] > 1 && kraftSum + (1LL << (maxCodeLength - lengths[i])) <= capacity)
+            {
+                kraftSum += 1LL << (maxCodeLength - lengths[i]);
+                --lengths[i];
+            }
+        }
+    }
+
+protected:
+    void getCodeLengths(std::vector<std::pair<unsigned char, ll>>& bytesCount, int* codeLengths) override
+    {
+        std::sort(bytesCount.begin(), bytesCount.end(), [](const std::pair<unsigned char, ll>& p1, const std::pair<unsigned char, ll>& p2)
+        {
+            return p1.second < p2.second;
+        });
+
+        int n = bytesCount.size();
+        std::vector<int> parents(2 * n - 1, -1);
+        std::priority_queue<std::pair<ll, int>, std::vector<std::pair<ll, int>>, std::greater<std::pair<ll, int>>> nodes;
+
+        for (int i = 0; i < n; ++i)
+        {
+            nodes.push(std::make_pair(bytesCount[i].second, i));
+        }
+
+        for (int next = n; nodes.size() > 1; ++next)
+        {
+            std::pair<ll, int> first = nodes.top();
+            nodes.pop();
+            std::pair<ll, int> second = nodes.top();
+            nodes.pop();
+
+            parents[first.second] = next;
+            parents[second.second] = next;
+            nodes.push(std::make_pair(first.first + second.first, next));
+        }
+
+        std::vector<int> lengths(n);
+        for (int i = 0; i < n; ++i)
+        {
+            for (int node = i; parents[node] >= 0; node = parents[node])
+            {
+                ++lengths[i];
+            }
+        }
+
+        limitLengths(lengths);
+
+        std::fill(codeLengths, codeLengths + 256, -1);
+        for (int i = 0; i < n; ++i)
+        {
+            codeLengths[bytesCount[i].first] = lengths[i];
+        }
+    }
+
+public:
+    Huffman(int blockSize = 0) : Shannon(blockSize) {}
+
+    std::string GetDescription() override
+    {
+        if (blockSize > 0)
+        {
+            return "Huffman (" + std::to_string(blockSize / 1024) + " KB blocks)";
+        }
+
+        return "Huffman";
+    }
+
+    std::string GetShortName() override
+    {
+        if (blockSize > 0)
+        {
+            return "hufb" + std::to_string(blockSize / 1024);
+        }
+
+        return "huf";
+    }
+};
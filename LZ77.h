@@ -1,8 +1,8 @@
 #include <iostream>
 #include <map>
 #include <vector>
-#include <queue>
 #include <algorithm>
+#include <cstring>
 #include "math.h"
 
 struct LZ77Node
@@ -16,300 +16,937 @@ public:
     LZ77Node() {}
 };
 
-class LZ77Archiver : public Archiver
+// Floor of log2(value): the width of the offset or length field for a history or view of that size.
+static constexpr int getLZ77FieldBits(int value)
+{
+    int bits = 0;
+    while ((value >> (bits + 1)) != 0)
+    {
+        ++bits;
+    }
+
+    return bits;
+}
+
+// The window holds the history and the view and twice as much again, rounded up to a power of two.
+static constexpr int getLZ77WindowSize(int historySize, int viewSize)
+{
+    int windowSize = 1;
+    while (windowSize <= historySize + viewSize)
+    {
+        windowSize <<= 1;
+    }
+
+    return windowSize << 1;
+}
+
+// With FixedHistorySize and FixedViewSize set the window sizes and masks are compile-time
+// constants; LZ77MatchFinder<> takes them from the constructor instead.
+template<int FixedHistorySize = 0, int FixedViewSize = 0>
+class LZ77MatchFinder
 {
 private:
+    static const int hashBits = 15;
+    static const int fixedWindowMask = getLZ77WindowSize(FixedHistorySize, FixedViewSize) - 1;
+
     int historySize;
-    int viewSize;
+    int maxChainLength;
+    int windowMask;
+    long long start = 0;
+    long long end = 0;
+    long long inserted = 0;
+    long long pairsInserted = 0;
+    long long hashesInserted = 0;
+
+    FileReader* fileReader = nullptr;
+    const unsigned char* input = nullptr;
+    const unsigned char* inputEnd = nullptr;
+
+    std::vector<unsigned char> window;
+    std::vector<long long> head;
+    std::vector<long long> chain;
+    std::vector<long long> lastPair;
+    std::vector<long long> lastByte;
+
+    int getWindowMask()
+    {
+        return FixedHistorySize > 0 ? (int)fixedWindowMask : windowMask;
+    }
+
+    int getHistorySize()
+    {
+        return FixedHistorySize > 0 ? FixedHistorySize : historySize;
+    }
+
+    int getHash(long long position)
+    {
+        unsigned int prefix = (window[position & getWindowMask()] << 16) | (window[(position + 1) & getWindowMask()] << 8) | window[(position + 2) & getWindowMask()];
+        return (int)((prefix * 2654435761u) >> (32 - hashBits));
+    }
+
+    int getPair(long long position)
+    {
+        return (window[position & getWindowMask()] << 8) | window[(position + 1) & getWindowMask()];
+    }
 
-    int find(std::vector<unsigned char>& history, std::vector<unsigned char>& view, int length)
+    int getMatchLength(long long candidate, long long position, int maxLength)
     {
-        for (int i = history.size() - 1; i >= 0; --i)
+        int length = 0;
+        while (length < maxLength && window[(candidate + length) & getWindowMask()] == window[(position + length) & getWindowMask()])
         {
-            if (history[i] == view[0])
+            ++length;
+        }
+
+        STATS_ADD(bytesCompared, length + (length < maxLength ? 1 : 0));
+        return length;
+    }
+
+    // Adds the inserted positions whose pair or hash needed bytes that had not been read yet.
+    void insertPending()
+    {
+        for (; pairsInserted < inserted && pairsInserted + 1 < end; ++pairsInserted)
+        {
+            lastPair[getPair(pairsInserted)] = pairsInserted;
+        }
+
+        for (; hashesInserted < inserted && hashesInserted + 2 < end; ++hashesInserted)
+        {
+            int hash = getHash(hashesInserted);
+            chain[hashesInserted & getWindowMask()] = head[hash];
+            head[hash] = hashesInserted;
+        }
+    }
+
+public:
+    LZ77MatchFinder(int historySize, int viewSize, int maxChainLength)
+    {
+        this->historySize = historySize;
+        this->maxChainLength = maxChainLength;
+
+        int windowSize = getLZ77WindowSize(historySize, viewSize);
+
+        windowMask = windowSize - 1;
+        window.resize(windowSize);
+        chain.resize(windowSize);
+        head.assign(1 << hashBits, -1);
+        lastPair.assign(1 << 16, -1);
+        lastByte.assign(1 << 8, -1);
+    }
+
+    // Starts over for a new source without clearing the tables: positions go on from the end of the
+    // old source, which is then out of reach of the matches. Returns the first position of the new one.
+    long long Restart()
+    {
+        start = inserted = pairsInserted = hashesInserted = end;
+        return end;
+    }
+
+    void SetSource(FileReader* fileReader)
+    {
+        this->fileReader = fileReader;
+    }
+
+    void SetSource(const unsigned char* bytes, size_t size)
+    {
+        input = bytes;
+        inputEnd = bytes + size;
+    }
+
+    // Reads as much of the source as fits without overwriting the history behind position.
+    // Returns false once the source is exhausted.
+    bool Fill(long long position)
+    {
+        int count = getWindowMask() + 1 - getHistorySize() - (int)(end - position);
+        while (count > 0)
+        {
+            int start = (int)(end & getWindowMask());
+            int chunk = std::min(count, getWindowMask() + 1 - start);
+            int readBytes;
+
+            if (fileReader != nullptr)
             {
-                int j;
-                int ii = i;
+                readBytes = fileReader->Read(&window[start], chunk);
+            }
+            else
+            {
+                readBytes = (int)std::min((size_t)chunk, (size_t)(inputEnd - input));
+                std::copy(input, input + readBytes, &window[start]);
+                input += readBytes;
+            }
 
-                for (j = 0; j < std::min((int)history.size() - i, length);)
-                {
-                    if (history[ii] == view[j])
-                    {
-                        ++ii;
-                        ++j;
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
+            end += readBytes;
+            count -= readBytes;
+
+            if (readBytes < chunk)
+            {
+                insertPending();
+                return false;
+            }
+        }
+
+        insertPending();
+        return true;
+    }
+
+    int GetLookahead(long long position)
+    {
+        return (int)(end - position);
+    }
 
-                if (j < length && ii == history.size()) 
+    unsigned char GetByte(long long position)
+    {
+        return window[position & getWindowMask()];
+    }
+
+    // Positions must be inserted in order once the cursor has moved past them.
+    void Insert(long long position)
+    {
+        lastByte[window[position & getWindowMask()]] = position;
+        inserted = position + 1;
+        insertPending();
+    }
+
+    // Returns the length of the longest match for the bytes at position (0 if none) and its distance in offset.
+    int FindLongest(long long position, int maxLength, int& offset)
+    {
+        long long minPosition = std::max(position - getHistorySize(), start);
+        long long bestPosition = -1;
+        int bestLength = 0;
+
+        if (maxLength >= 3)
+        {
+            long long candidate = head[getHash(position)];
+            for (int depth = 0; depth < maxChainLength && candidate >= minPosition; ++depth)
+            {
+                STATS_ADD(matchProbes, 1);
+                if (window[(candidate + bestLength) & getWindowMask()] == window[(position + bestLength) & getWindowMask()])
                 {
-                    int k = 0;
-                    for (k = 0; k < view.size() && j + k < length; ++k)
+                    int length = getMatchLength(candidate, position, maxLength);
+                    if (length > bestLength)
                     {
-                        if (view[k] != view[j + k])
+                        bestLength = length;
+                        bestPosition = candidate;
+
+                        if (length == maxLength)
                         {
                             break;
                         }
                     }
-
-                    if (k + j == length)
-                    {
-                        return i;
-                    }
-                }
-                else
-                {
-                    if (j == length)
-                    {
-                        return i;
-                    }
                 }
+
+                candidate = chain[candidate & getWindowMask()];
             }
         }
 
-        return -1;
-    }
-
-    int doStep(std::vector<unsigned char>& history, std::vector<unsigned char>& view, std::vector<LZ77Node*>& nodes)
-    {
-        int foundIndex = -1;
-        int i;
-        for (i = 0; i < view.size() - 1; ++i)
+        if (bestLength < 2 && maxLength >= 2)
         {
-            int newFoundIndex = find(history, view, i + 1);
+            long long candidate = lastPair[getPair(position)];
+            if (candidate >= minPosition)
+            {
+                STATS_ADD(matchProbes, 1);
+                bestLength = getMatchLength(candidate, position, maxLength);
+                bestPosition = candidate;
+            }
+        }
 
-            if (newFoundIndex == -1 || newFoundIndex >= history.size())
+        if (bestLength < 1 && maxLength >= 1)
+        {
+            long long candidate = lastByte[window[position & getWindowMask()]];
+            if (candidate >= minPosition)
             {
-                break;
+                bestLength = 1;
+                bestPosition = candidate;
             }
-            
-            foundIndex = newFoundIndex;
         }
 
-        if (foundIndex == -1)
+        offset = (int)(position - bestPosition);
+        return bestLength;
+    }
+};
+
+class LZ77ArchiveStream;
+class LZ77DearchiveStream;
+
+class LZ77Archiver : public Archiver
+{
+private:
+    friend class LZ77ArchiveStream;
+    friend class LZ77DearchiveStream;
+
+    static const int writeBlockSize = 64 * 1024;
+    static const int copySlack = 8;
+
+    int historySize;
+    int viewSize;
+    int bitsPerOffset;
+    int bitsPerLength;
+    int level;
+    int maxChainLength;
+
+    // The coding loops are templates over the history and view sizes so that the instantiations for
+    // the common sizes get the field widths and window masks as constants. Sizes of 0 stand for the
+    // ones of the archiver, which is what all other sizes and the streams use.
+    template<int FixedHistorySize, int FixedViewSize>
+    int getHistorySize()
+    {
+        return FixedHistorySize > 0 ? FixedHistorySize : historySize;
+    }
+
+    template<int FixedHistorySize, int FixedViewSize>
+    int getViewSize()
+    {
+        return FixedViewSize > 0 ? FixedViewSize : viewSize;
+    }
+
+    template<int FixedHistorySize, int FixedViewSize>
+    int getBitsPerOffset()
+    {
+        return FixedHistorySize > 0 ? getLZ77FieldBits(FixedHistorySize) : bitsPerOffset;
+    }
+
+    template<int FixedHistorySize, int FixedViewSize>
+    int getBitsPerLength()
+    {
+        return FixedViewSize > 0 ? getLZ77FieldBits(FixedViewSize) : bitsPerLength;
+    }
+
+    template<int FixedHistorySize, int FixedViewSize>
+    int doStep(long long position, std::vector<LZ77Node>& nodes, LZ77MatchFinder<FixedHistorySize, FixedViewSize>& matchFinder)
+    {
+        int offset = 0;
+        int lookahead = std::min(matchFinder.GetLookahead(position), getViewSize<FixedHistorySize, FixedViewSize>());
+        int length = matchFinder.FindLongest(position, lookahead - 1, offset);
+
+        STATS_ADD(tokens, 1);
+        STATS_ADD(matches, length > 0 ? 1 : 0);
+        STATS_ADD(matchedBytes, length);
+
+        if (length == 0)
         {
-            nodes.push_back(new LZ77Node(0, 0, view[0]));
+            nodes.push_back(LZ77Node(0, 0, matchFinder.GetByte(position)));
         }
         else
         {
-            nodes.push_back(new LZ77Node(history.size() - foundIndex, i, view[i]));
+            nodes.push_back(LZ77Node(offset, length, matchFinder.GetByte(position + length)));
         }
 
-        return i + 1;
+        return length + 1;
     }
 
-    void writeNodesToFile(std::vector<LZ77Node*>& nodes, bool flushQueue, std::queue<bool>& bits, FileWriter* fileWriter)
+    template<int FixedHistorySize, int FixedViewSize>
+    void step(long long& position, std::vector<LZ77Node>& nodes, LZ77MatchFinder<FixedHistorySize, FixedViewSize>& matchFinder)
     {
-        int bitsPerOffset = (int)std::log2(historySize);
-        int bitsPerLength = (int)std::log2(viewSize);
-        std::vector<unsigned char> bytesToWrite;
+        int foundPrefixLength = doStep(position, nodes, matchFinder);
 
-        for (LZ77Node* node : nodes)
+        for (int i = 0; i < foundPrefixLength; ++i)
         {
-            std::vector<bool> tempBits = getBitsFromInt(node->offset, bitsPerOffset);
-            for (bool bit : tempBits)
-            {
-                bits.push(bit);
-            }
+            matchFinder.Insert(position++);
+        }
+    }
+
+    template<int FixedHistorySize, int FixedViewSize>
+    void writeNodesToFile(std::vector<LZ77Node>& nodes, bool flushWriter, BitWriter& bitWriter, std::vector<unsigned char>& bytesToWrite, FileWriter* fileWriter)
+    {
+        for (LZ77Node& node : nodes)
+        {
+            bitWriter.Write(node.offset, getBitsPerOffset<FixedHistorySize, FixedViewSize>());
+            bitWriter.Write(node.length, getBitsPerLength<FixedHistorySize, FixedViewSize>());
+            bitWriter.Write(node.nextChar, 8);
+        }
+
+        if (flushWriter)
+        {
+            bitWriter.Close();
+        }
+
+        if (fileWriter != nullptr && (bytesToWrite.size() >= writeBlockSize || (flushWriter && bytesToWrite.size() > 0)))
+        {
+            fileWriter->Write(&bytesToWrite);
+            bytesToWrite.clear();
+        }
+
+        // The nodes are kept by value, so the buffer is reused by the next steps without allocating.
+        nodes.clear();
+    }
+
+    // Reads the next triple into node; returns false if it is the marker of a sync point instead.
+    bool getLZ77Node(BitReader& bitReader, LZ77Node* node)
+    {
+        int offset = bitReader.Read(bitsPerOffset);
+        int length = bitReader.Read(bitsPerLength);
+        unsigned char byte = (unsigned char)bitReader.Read(8);
+
+        if (offset != 0 && length == 0)
+        {
+            return false;
+        }
+
+        node->offset = (offset == 0 && length != 0 ? historySize : offset);
+        node->length = length;
+        node->nextChar = byte;
+        return true;
+    }
+
+    // A match is never as long as the view, so a triple with an offset and no length can mark a
+    // sync point that Flush writes into a stream.
+    void writeSyncPoint(BitWriter& bitWriter)
+    {
+        bitWriter.Write(1, bitsPerOffset);
+        bitWriter.Write(0, bitsPerLength);
+        bitWriter.Write(0, 8);
+        bitWriter.WriteSyncPadding();
+    }
 
-            tempBits = getBitsFromInt(node->length, bitsPerLength);
-            for (bool bit : tempBits)
+    // Writes the whole source as tokens through bitWriter; with a null fileWriter everything stays
+    // in its output.
+    template<int FixedHistorySize, int FixedViewSize>
+    void archive(LZ77MatchFinder<FixedHistorySize, FixedViewSize>& matchFinder, BitWriter& bitWriter, std::vector<unsigned char>& bytesToWrite, FileWriter* fileWriter)
+    {
+        STATS_TIMER(parseSeconds);
+
+        std::vector<LZ77Node> nodes;
+        long long position = 0;
+        bool endOfFile = false;
+
+        while (true)
+        {
+            if (!endOfFile && matchFinder.GetLookahead(position) < getViewSize<FixedHistorySize, FixedViewSize>())
             {
-                bits.push(bit);
+                endOfFile = !matchFinder.Fill(position);
             }
 
-            tempBits = getBitsFromByte(node->nextChar);
-            for (bool bit : tempBits)
+            if (matchFinder.GetLookahead(position) == 0)
             {
-                bits.push(bit);
+                break;
             }
 
-            bytesToWrite.clear();
+            step(position, nodes, matchFinder);
+            writeNodesToFile<FixedHistorySize, FixedViewSize>(nodes, false, bitWriter, bytesToWrite, fileWriter);
+        }
+
+        writeNodesToFile<FixedHistorySize, FixedViewSize>(nodes, true, bitWriter, bytesToWrite, fileWriter);
+    }
+
+    // Either source is used: the bytes, or the fileReader when it is not null.
+    template<int FixedHistorySize, int FixedViewSize>
+    void archive(const unsigned char* bytes, size_t size, FileReader* fileReader, BitWriter& bitWriter, std::vector<unsigned char>& bytesToWrite, FileWriter* fileWriter)
+    {
+        LZ77MatchFinder<FixedHistorySize, FixedViewSize> matchFinder(historySize, viewSize, maxChainLength);
+
+        if (fileReader != nullptr)
+        {
+            matchFinder.SetSource(fileReader);
+        }
+        else
+        {
+            matchFinder.SetSource(bytes, size);
+        }
+
+        archive(matchFinder, bitWriter, bytesToWrite, fileWriter);
+    }
+
+    void archive(const unsigned char* bytes, size_t size, FileReader* fileReader, BitWriter& bitWriter, std::vector<unsigned char>& bytesToWrite, FileWriter* fileWriter)
+    {
+        if (historySize == 4 * 1024 && viewSize == 1024)
+        {
+            archive<4 * 1024, 1024>(bytes, size, fileReader, bitWriter, bytesToWrite, fileWriter);
+        }
+        else if (historySize == 8 * 1024 && viewSize == 2 * 1024)
+        {
+            archive<8 * 1024, 2 * 1024>(bytes, size, fileReader, bitWriter, bytesToWrite, fileWriter);
+        }
+        else if (historySize == 16 * 1024 && viewSize == 4 * 1024)
+        {
+            archive<16 * 1024, 4 * 1024>(bytes, size, fileReader, bitWriter, bytesToWrite, fileWriter);
+        }
+        else
+        {
+            archive<0, 0>(bytes, size, fileReader, bitWriter, bytesToWrite, fileWriter);
+        }
+    }
+
+    // Copies length bytes from offset bytes back, eight at a time when the match is far enough
+    // behind, so up to copySlack bytes past the end get overwritten. Closer matches overlap: the
+    // copies then grow with the distance already written, which repeats the run the same way a
+    // byte by byte copy would.
+    static void copyMatch(unsigned char* destination, int offset, int length)
+    {
+        const unsigned char* source = destination - offset;
 
-            while (bits.size() >= 8)
+        if (offset >= 8)
+        {
+            for (int i = 0; i < length; i += 8)
             {
-                bytesToWrite.push_back(getByteFromQueue(&bits));
+                std::memcpy(destination + i, source + i, 8);
             }
 
-            fileWriter->Write(&bytesToWrite);
+            return;
         }
 
-        if (flushQueue)
+        while (length > 0)
         {
-            unsigned char lastByteSize = bits.size();
-            unsigned char lastByte = 0;
+            int count = std::min((int)(destination - source), length);
+            std::memcpy(destination, source, count);
+            destination += count;
+            length -= count;
+        }
+    }
+
+    // Decodes into out, which also holds the history. Without a fileWriter out grows to the whole
+    // output; with one it is a fixed window whose older part is written and dropped as it fills up.
+    template<int FixedHistorySize, int FixedViewSize>
+    void dearchive(BitReader& bitReader, std::vector<unsigned char>& out, FileWriter* fileWriter)
+    {
+        int historySize = getHistorySize<FixedHistorySize, FixedViewSize>();
+        int viewSize = getViewSize<FixedHistorySize, FixedViewSize>();
+        int bitsPerOffset = getBitsPerOffset<FixedHistorySize, FixedViewSize>();
+        int bitsPerLength = getBitsPerLength<FixedHistorySize, FixedViewSize>();
+        int oneTripleSize = bitsPerOffset + bitsPerLength + 8;
+        size_t start = out.size();
+        size_t used = start;
+        size_t written = 0;
+
+        if (fileWriter != nullptr)
+        {
+            out.resize(historySize + 16 * writeBlockSize + viewSize + 1 + copySlack);
+        }
+
+        while (bitReader.GetBitsLeft() >= (unsigned long long)oneTripleSize)
+        {
+            int offset = bitReader.Read(bitsPerOffset);
+            int length = bitReader.Read(bitsPerLength);
+            unsigned char nextChar = (unsigned char)bitReader.Read(8);
 
-            for (int i = 7; i >= 0; --i)
+            if (length == 0 && offset != 0)
             {
-                if (bits.empty())
+                int paddingBits = bitReader.GetSyncPaddingBits();
+                if ((unsigned long long)paddingBits > bitReader.GetBitsLeft())
                 {
                     break;
                 }
 
-                if (bits.front())
+                bitReader.Read(paddingBits);
+                continue;
+            }
+
+            offset = (offset == 0 && length != 0 ? historySize : offset);
+
+            if (used + length + 1 + copySlack > out.size())
+            {
+                if (fileWriter == nullptr)
                 {
-                    lastByte += (unsigned char)pow(2, i);
+                    out.resize(std::max(2 * out.size(), used + length + 1 + copySlack));
+                }
+                else
+                {
+                    fileWriter->Write(&out[written], used - written);
+                    std::memmove(&out[0], &out[used - historySize], historySize);
+                    used = written = historySize;
                 }
-
-                bits.pop();
             }
 
-            bytesToWrite.clear();
-            bytesToWrite.push_back(lastByte);
-            bytesToWrite.push_back(lastByteSize);
+            if ((size_t)offset > used - start)
+            {
+                break;
+            }
 
-            fileWriter->Write(&bytesToWrite);
+            STATS_ADD(tokens, 1);
+            copyMatch(&out[used], offset, length);
+            used += length;
+            out[used++] = nextChar;
         }
 
-        for (int i = 0; i < nodes.size(); ++i)
+        if (fileWriter != nullptr)
+        {
+            if (used > written)
+            {
+                fileWriter->Write(&out[written], used - written);
+            }
+        }
+        else
         {
-            LZ77Node* node = nodes[0];
-            nodes.erase(nodes.begin());
-            delete node;
+            out.resize(used);
         }
     }
 
-    void getLZ77Node(std::vector<bool>& bits, LZ77Node* node)
+    void dearchive(BitReader& bitReader, std::vector<unsigned char>& out, FileWriter* fileWriter)
     {
-        int offset = getIntFromBits(bits, (int)log2(historySize));
-        int length = getIntFromBits(bits, (int)log2(viewSize));
-        unsigned char byte = (unsigned char)getIntFromBits(bits, 8);
-
-        if (offset == 0 && length == 0) 
+        if (historySize == 4 * 1024 && viewSize == 1024)
+        {
+            dearchive<4 * 1024, 1024>(bitReader, out, fileWriter);
+        }
+        else if (historySize == 8 * 1024 && viewSize == 2 * 1024)
+        {
+            dearchive<8 * 1024, 2 * 1024>(bitReader, out, fileWriter);
+        }
+        else if (historySize == 16 * 1024 && viewSize == 4 * 1024)
         {
-            node->offset = 0;
-            node->length = 0;
+            dearchive<16 * 1024, 4 * 1024>(bitReader, out, fileWriter);
         }
         else
         {
-            node->offset = (offset == 0 ? historySize : offset);
-            node->length = (length == 0 ? viewSize : length);
+            dearchive<0, 0>(bitReader, out, fileWriter);
         }
-
-        node->nextChar = byte;
     }
 
-    void pushByteToHistory(std::vector<unsigned char>& history, unsigned char byteToPush)
-    {
-        history.push_back(byteToPush);
-    }
 public:
+    static const int defaultLevel = 6;
+    static const int maxLevel = 9;
+
     LZ77Archiver(int historySize, int viewSize)
     {
         this->historySize = historySize;
         this->viewSize = viewSize;
+        this->bitsPerOffset = getLZ77FieldBits(historySize);
+        this->bitsPerLength = getLZ77FieldBits(viewSize);
+        this->level = defaultLevel;
+        this->maxChainLength = GetMaxChainLength(defaultLevel, historySize);
+    }
+
+    // The level sets how many earlier positions are tried for each match; it has no effect on the
+    // format or on decoding. Every token has the same size and a match stays a match when its first
+    // byte is cut off, so taking the longest match at each step is an optimal parse: maxLevel
+    // searches the whole history for it, lower levels trade some ratio for speed.
+    // Returns nullptr for a level outside of 1 to maxLevel.
+    static LZ77Archiver* CreateWithLevel(int historySize, int viewSize, int level)
+    {
+        if (level < 1 || level > maxLevel)
+        {
+            return nullptr;
+        }
+
+        LZ77Archiver* archiver = new LZ77Archiver(historySize, viewSize);
+        archiver->level = level;
+        archiver->maxChainLength = GetMaxChainLength(level, historySize);
+        return archiver;
+    }
+
+    static int GetMaxChainLength(int level, int historySize)
+    {
+        static const int maxChainLengths[maxLevel - 1] = {4, 8, 16, 32, 64, 256, 1024, 4096};
+        return level >= maxLevel ? historySize : maxChainLengths[std::max(level, 1) - 1];
     }
 
+    using Archiver::Archive;
+    using Archiver::Dearchive;
+
     void Archive(const std::string inputFile, const std::string outFile) override
     {
-        std::vector<unsigned char> history;
-        std::vector<unsigned char> view;
-        std::vector<LZ77Node*> nodes;
-        std::queue<bool> bits;
-        int readBytes;
+        STATS_SCOPE(stats);
+
+        std::vector<unsigned char> bytesToWrite;
+        BitWriter bitWriter(&bytesToWrite);
+        FileReader* fileReader = new FileReader(inputFile);
+        FileWriter* fileWriter = new FileWriter(outFile);
+
+        if (fileReader->GetData() != nullptr)
+        {
+            archive(fileReader->GetData(), fileReader->GetSize(), nullptr, bitWriter, bytesToWrite, fileWriter);
+        }
+        else
+        {
+            archive(nullptr, 0, fileReader, bitWriter, bytesToWrite, fileWriter);
+        }
+
+        delete fileReader;
+        delete fileWriter;
+    }
+
+    void Dearchive(const std::string inputFile, const std::string outFile) override
+    {
+        STATS_SCOPE(stats);
+
         FileReader* fileReader = new FileReader(inputFile);
         FileWriter* fileWriter = new FileWriter(outFile);
+        BitReader* bitReader = BitReader::Open(fileReader);
+        std::vector<unsigned char> window;
+
+        dearchive(*bitReader, window, fileWriter);
+
+        delete bitReader;
+        delete fileWriter;
+        delete fileReader;
+    }
+
+    void Archive(ByteSpan input, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        BitWriter bitWriter(&out);
+        archive(input.data, input.size, nullptr, bitWriter, out, nullptr);
+    }
+
+    size_t Archive(ByteSpan input, unsigned char* out, size_t capacity) override
+    {
+        STATS_SCOPE(stats);
+
+        std::vector<unsigned char> bytesToWrite;
+        BitWriter bitWriter(out, capacity);
+
+        archive(input.data, input.size, nullptr, bitWriter, bytesToWrite, nullptr);
+        return bitWriter.GetBufferSize();
+    }
+
+    void Dearchive(ByteSpan input, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        BitReader bitReader(input.data, input.size, BitReader::GetPayloadBitsCount(input.data, input.size));
+        dearchive(bitReader, out, nullptr);
+    }
+
+    void ArchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        Archive(ByteSpan(bytes, size), out);
+    }
+
+    void DearchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        Dearchive(ByteSpan(bytes, size), out);
+    }
+
+    ArchiverStream* CreateArchiveStream() override;
+    ArchiverStream* CreateDearchiveStream() override;
+
+    // A match finder for GetArchivedSize, which one caller can keep for many calls.
+    LZ77MatchFinder<> CreateMatchFinder()
+    {
+        return LZ77MatchFinder<>(historySize, viewSize, maxChainLength);
+    }
+
+    // The size Archive writes for the bytes, found by the same parse without coding the triples.
+    long long GetArchivedSize(const unsigned char* bytes, size_t size, LZ77MatchFinder<>& matchFinder)
+    {
+        long long position = matchFinder.Restart();
+        long long triplesCount = 0;
+        bool endOfFile = false;
 
-        for (int i = 0; i < viewSize; ++i)
+        matchFinder.SetSource(bytes, size);
+        while (true)
         {
-            unsigned char byte = fileReader->ReadNextChar(readBytes);
+            if (!endOfFile && matchFinder.GetLookahead(position) < viewSize)
+            {
+                endOfFile = !matchFinder.Fill(position);
+            }
 
-            if (readBytes == 0)
+            int lookahead = std::min(matchFinder.GetLookahead(position), viewSize);
+            if (lookahead == 0)
             {
                 break;
             }
 
-            view.push_back(byte);
+            int offset = 0;
+            int length = matchFinder.FindLongest(position, lookahead - 1, offset);
+
+            for (int i = 0; i <= length; ++i)
+            {
+                matchFinder.Insert(position++);
+            }
+
+            ++triplesCount;
         }
 
-        do
+        return triplesCount * (bitsPerOffset + bitsPerLength + 8) / 8 + 2;
+    }
+
+    std::string GetDescription() override 
+    {
+        if (level != defaultLevel)
         {
-            int foundPrefixLength = doStep(history, view, nodes);
+            return "LZ77 (level " + std::to_string(level) + ")";
+        }
 
-            for (int i = 0; i < foundPrefixLength; ++i)
-            {
-                if (history.size() == historySize)
-                {
-                    history.erase(history.begin());
-                }
+        return "LZ77";
+    }
+
+    std::string GetShortName() override
+    {
+        if (level != defaultLevel)
+        {
+            return "lz77" + std::to_string(((historySize + viewSize) / 1024)) + "l" + std::to_string(level);
+        }
+
+        return "lz77" + std::to_string(((historySize + viewSize) / 1024));
+    }
+};
+
+// Without Flush the output is the same as LZ77Archiver::Archive writes for the whole input.
+class LZ77ArchiveStream : public ArchiverStream
+{
+private:
+    LZ77Archiver* archiver;
+    LZ77MatchFinder<> matchFinder;
+    long long position = 0;
+    bool filling = false;
+    std::vector<LZ77Node> nodes;
+    std::vector<unsigned char> bytesToWrite;
+    BitWriter bitWriter;
+
+    void moveBytes(std::vector<unsigned char>& out)
+    {
+        out.insert(out.end(), bytesToWrite.begin(), bytesToWrite.end());
+        bytesToWrite.clear();
+    }
+
+    void encodeLookahead()
+    {
+        while (matchFinder.GetLookahead(position) > 0)
+        {
+            archiver->step(position, nodes, matchFinder);
+            archiver->writeNodesToFile<0, 0>(nodes, false, bitWriter, bytesToWrite, nullptr);
+        }
+    }
+
+public:
+    LZ77ArchiveStream(LZ77Archiver* archiver)
+        : archiver(archiver), matchFinder(archiver->historySize, archiver->viewSize, archiver->maxChainLength), bitWriter(&bytesToWrite) {}
 
-                history.push_back(view.front());
-                view.erase(view.begin());
+    void Update(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(archiver->stats);
 
-                unsigned char byte = fileReader->ReadNextChar(readBytes);
+        // The window is refilled at the same points as in a pass over the whole input: a refill
+        // the chunk could not complete is resumed by the next Update before any further step.
+        matchFinder.SetSource(bytes, size);
+        while (true)
+        {
+            if (matchFinder.GetLookahead(position) < archiver->viewSize)
+            {
+                filling = true;
+            }
 
-                if (readBytes != 0)
+            if (filling)
+            {
+                if (!matchFinder.Fill(position))
                 {
-                    view.push_back(byte);
+                    break;
                 }
+
+                filling = false;
             }
 
-            writeNodesToFile(nodes, false, bits, fileWriter);
+            archiver->step(position, nodes, matchFinder);
+            archiver->writeNodesToFile<0, 0>(nodes, false, bitWriter, bytesToWrite, nullptr);
         }
-        while (view.size() > 0);
 
-        writeNodesToFile(nodes, true, bits, fileWriter);
+        moveBytes(out);
+    }
 
-        delete fileReader;
-        delete fileWriter;
+    // Codes all the buffered input and ends it with a sync point, so that the receiver can decode
+    // all of it from what has been written so far.
+    void Flush(std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(archiver->stats);
+
+        encodeLookahead();
+        archiver->writeSyncPoint(bitWriter);
+        moveBytes(out);
     }
 
-    void Dearchive(const std::string inputFile, const std::string outFile) override
+    void Finish(std::vector<unsigned char>& out) override
     {
-        FileReader* fileReader = new FileReader(inputFile);
-        FileWriter* fileWriter = new FileWriter(outFile);
+        STATS_SCOPE(archiver->stats);
 
-        int readBytes;
-        int oneTripleSize = (int)log2(historySize) + (int)log2(viewSize) + 8;
-        std::vector<unsigned char> bytes(oneTripleSize );
-        std::vector<unsigned char> history;
-        LZ77Node* node = new LZ77Node();
+        encodeLookahead();
+        bitWriter.Close();
+        moveBytes(out);
+    }
+};
 
-        do
+class LZ77DearchiveStream : public ArchiverStream
+{
+private:
+    LZ77Archiver* archiver;
+    BitStreamBuffer input;
+    std::vector<unsigned char> history;
+    int syncBitsLeft = 0;
+    bool failed = false;
+
+    // Skips what has arrived of the padding of a sync point; false while some of it is still to come.
+    bool skipSyncPadding(BitReader* bitReader)
+    {
+        int count = (int)std::min((unsigned long long)syncBitsLeft, bitReader->GetBitsLeft());
+        if (count > 0)
         {
-            readBytes = fileReader->Read(&bytes, oneTripleSize);
-            std::vector<bool> bits = getBitsFromBytes(bytes, readBytes);
-            while (bits.size() >= oneTripleSize)
-            {
-                getLZ77Node(bits, node);
+            bitReader->Read(count);
+            syncBitsLeft -= count;
+        }
 
-                if (node->length == 0 && node->offset == 0)
-                {
-                    fileWriter->WriteByte(node->nextChar);
-                    pushByteToHistory(history, node->nextChar);
-                }
-                else
-                {
-                    int a = history.size() - node->offset;
+        return syncBitsLeft == 0;
+    }
 
-                    for (int i = a; i < a + node->length; ++i)
-                    {
-                        fileWriter->WriteByte(history[i]);
-                        pushByteToHistory(history, history[i]);
-                    }
+    void decode(bool finished, std::vector<unsigned char>& out)
+    {
+        int oneTripleSize = archiver->bitsPerOffset + archiver->bitsPerLength + 8;
+        BitReader* bitReader = input.Open(finished);
+        size_t start = history.size();
+        LZ77Node node;
+
+        while (!failed && skipSyncPadding(bitReader) && bitReader->GetBitsLeft() >= (unsigned long long)oneTripleSize)
+        {
+            if (!archiver->getLZ77Node(*bitReader, &node))
+            {
+                syncBitsLeft = bitReader->GetSyncPaddingBits();
+                continue;
+            }
+
+            // A match reaching before the first decoded byte can only come from a damaged stream.
+            if ((size_t)node.offset > history.size())
+            {
+                failed = true;
+                break;
+            }
 
-                    pushByteToHistory(history, node->nextChar);
-                    fileWriter->WriteByte(node->nextChar);
-                }   
+            size_t matchStart = history.size() - node.offset;
+            for (int i = 0; i < node.length; ++i)
+            {
+                history.push_back(history[matchStart + i]);
             }
+
+            history.push_back(node.nextChar);
         }
-        while (readBytes == oneTripleSize);
 
-        delete node;
-        delete fileWriter;
-        delete fileReader;
+        input.Close(bitReader);
+        out.insert(out.end(), history.begin() + start, history.end());
+
+        if (history.size() > 2 * (size_t)archiver->historySize)
+        {
+            history.erase(history.begin(), history.end() - archiver->historySize);
+        }
     }
 
-    std::string GetDescription() override 
+public:
+    LZ77DearchiveStream(LZ77Archiver* archiver) : archiver(archiver) {}
+
+    void Update(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
     {
-        return "LZ77";
+        STATS_SCOPE(archiver->stats);
+
+        input.Append(bytes, size);
+        decode(false, out);
     }
 
-    std::string GetShortName() override
+    // Everything that can be decoded already is after each Update.
+    void Flush(std::vector<unsigned char>&) override {}
+
+    void Finish(std::vector<unsigned char>& out) override
     {
-        return "lz77" + std::to_string(((historySize + viewSize) / 1024));
+        STATS_SCOPE(archiver->stats);
+
+        decode(true, out);
     }
-};
\ No newline at end of file
+};
+
+ArchiverStream* LZ77Archiver::CreateArchiveStream()
+{
+    return new LZ77ArchiveStream(this);
+}
+
+ArchiverStream* LZ77Archiver::CreateDearchiveStream()
+{
+    return new LZ77DearchiveStream(this);
+}
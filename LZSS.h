@@ -0,0 +1,438 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+struct LZSSToken
+{
+public:
+    int length;
+    int offset;
+    unsigned char literal;
+
+    LZSSToken(int length, int offset, unsigned char literal) : length(length), offset(offset), literal(literal) {}
+};
+
+// LZ77 with tokens of variable size: a flag bit, then either a literal or a match (length, offset).
+// Literals, match lengths and offsets are coded with their own Shannon codes, built per block.
+class LZSSArchiver : public Archiver
+{
+private:
+    static const int minMatchLength = 3;
+    static const int blockSize = 256 * 1024;
+    static const int writeBlockSize = 64 * 1024;
+
+    struct SymbolCodes
+    {
+    public:
+        ll bits[256];
+        int lengths[256];
+    };
+
+    struct SymbolDecoder
+    {
+    public:
+        std::vector<Shannon::Code> codes;
+        std::vector<Shannon::DecodeEntry> table;
+        int primaryBits;
+    };
+
+    int historySize;
+    int viewSize;
+    int level;
+    Shannon shannon;
+
+    // Lengths and offsets are coded as a slot, which goes through the Shannon code, followed by
+    // extraBits raw bits: 0..3 have a slot each, every further power of two is split over two slots.
+    static int getSlot(int value, int& extraBits)
+    {
+        if (value < 4)
+        {
+            extraBits = 0;
+            return value;
+        }
+
+        int highBit = 2;
+        while ((value >> (highBit + 1)) != 0)
+        {
+            ++highBit;
+        }
+
+        extraBits = highBit - 1;
+        return 2 * highBit + ((value >> extraBits) & 1);
+    }
+
+    static int getSlotBase(int slot, int& extraBits)
+    {
+        if (slot < 4)
+        {
+            extraBits = 0;
+            return slot;
+        }
+
+        extraBits = slot / 2 - 1;
+        return (2 | (slot & 1)) << extraBits;
+    }
+
+    void writeTable(ll* counts, BitWriter& bitWriter, SymbolCodes& codes)
+    {
+        std::vector<std::pair<unsigned char, ll>> symbolsCount;
+
+        for (int symbol = 0; symbol < 256; ++symbol)
+        {
+            if (counts[symbol] > 0)
+            {
+                symbolsCount.push_back(std::make_pair((unsigned char)symbol, counts[symbol]));
+            }
+        }
+
+        if (symbolsCount.empty())
+        {
+            symbolsCount.push_back(std::make_pair((unsigned char)0, 1ULL));
+        }
+
+        shannon.writeTable(symbolsCount, bitWriter, codes.bits, codes.lengths);
+    }
+
+    void writeValue(int value, SymbolCodes& codes, BitWriter& bitWriter)
+    {
+        int extraBits;
+        int slot = getSlot(value, extraBits);
+
+        bitWriter.Write(codes.bits[slot], codes.lengths[slot]);
+        bitWriter.Write(value, extraBits);
+    }
+
+    // A block is written as its size in input bytes (32 bits), the literal, length and offset
+    // tables and its tokens.
+    void writeBlock(std::vector<LZSSToken>& tokens, int rawSize, BitWriter& bitWriter, std::vector<unsigned char>& bytesToWrite, FileWriter* fileWriter)
+    {
+        ll literalCounts[256] = {};
+        ll lengthCounts[256] = {};
+        ll offsetCounts[256] = {};
+        int extraBits;
+
+        for (LZSSToken& token : tokens)
+        {
+            if (token.length == 0)
+            {
+                ++literalCounts[token.literal];
+            }
+            else
+            {
+                ++lengthCounts[getSlot(token.length - minMatchLength, extraBits)];
+                ++offsetCounts[getSlot(token.offset - 1, extraBits)];
+            }
+        }
+
+        SymbolCodes literals;
+        SymbolCodes lengths;
+        SymbolCodes offsets;
+
+        bitWriter.Write(rawSize, 32);
+        writeTable(literalCounts, bitWriter, literals);
+        writeTable(lengthCounts, bitWriter, lengths);
+        writeTable(offsetCounts, bitWriter, offsets);
+
+        for (size_t i = 0; i < tokens.size(); ++i)
+        {
+            if (tokens[i].length == 0)
+            {
+                bitWriter.Write(0, 1);
+                bitWriter.Write(literals.bits[tokens[i].literal], literals.lengths[tokens[i].literal]);
+            }
+            else
+            {
+                bitWriter.Write(1, 1);
+                writeValue(tokens[i].length - minMatchLength, lengths, bitWriter);
+                writeValue(tokens[i].offset - 1, offsets, bitWriter);
+            }
+
+            if ((i & 0xFFF) == 0)
+            {
+                shannon.flushBytes(bytesToWrite, fileWriter, writeBlockSize);
+            }
+        }
+
+        tokens.clear();
+    }
+
+    // Writes the whole source through bitWriter; with a null fileWriter everything stays in its output.
+    void archive(LZ77MatchFinder<>& matchFinder, BitWriter& bitWriter, std::vector<unsigned char>& bytesToWrite, FileWriter* fileWriter)
+    {
+        STATS_TIMER(parseSeconds);
+
+        std::vector<LZSSToken> tokens;
+        long long position = 0;
+        long long blockStart = 0;
+        bool endOfFile = false;
+
+        while (true)
+        {
+            if (!endOfFile && matchFinder.GetLookahead(position) < viewSize)
+            {
+                endOfFile = !matchFinder.Fill(position);
+            }
+
+            int lookahead = matchFinder.GetLookahead(position);
+            if (lookahead == 0)
+            {
+                break;
+            }
+
+            int offset = 0;
+            int length = matchFinder.FindLongest(position, std::min(lookahead, viewSize), offset);
+
+            if (length < minMatchLength)
+            {
+                tokens.push_back(LZSSToken(0, 0, matchFinder.GetByte(position)));
+                length = 1;
+            }
+            else
+            {
+                tokens.push_back(LZSSToken(length, offset, 0));
+                STATS_ADD(matches, 1);
+                STATS_ADD(matchedBytes, length);
+            }
+
+            STATS_ADD(tokens, 1);
+
+            for (int i = 0; i < length; ++i)
+            {
+                matchFinder.Insert(position++);
+            }
+
+            if (position - blockStart >= blockSize)
+            {
+                writeBlock(tokens, (int)(position - blockStart), bitWriter, bytesToWrite, fileWriter);
+                blockStart = position;
+            }
+        }
+
+        if (!tokens.empty())
+        {
+            writeBlock(tokens, (int)(position - blockStart), bitWriter, bytesToWrite, fileWriter);
+        }
+
+        bitWriter.Close();
+        shannon.flushBytes(bytesToWrite, fileWriter, 0);
+    }
+
+    void readTable(BitReader& bitReader, SymbolDecoder& decoder)
+    {
+        decoder.codes = shannon.readCodes(bitReader);
+        decoder.table.clear();
+        decoder.primaryBits = shannon.buildDecodeTable(decoder.table, decoder.codes, 0);
+    }
+
+    int readSymbol(BitReader& bitReader, SymbolDecoder& decoder)
+    {
+        if (decoder.primaryBits == 0)
+        {
+            return decoder.codes[0].byte;
+        }
+
+        return shannon.decodeSymbol(bitReader, decoder.table, decoder.primaryBits);
+    }
+
+    // Returns -1 when the stream ends before the whole value.
+    int readValue(BitReader& bitReader, SymbolDecoder& decoder)
+    {
+        int slot = readSymbol(bitReader, decoder);
+        if (slot < 0)
+        {
+            return -1;
+        }
+
+        int extraBits;
+        int value = getSlotBase(slot, extraBits);
+
+        if (extraBits > 0)
+        {
+            if (bitReader.GetBitsLeft() < (unsigned long long)extraBits)
+            {
+                return -1;
+            }
+
+            value += bitReader.Read(extraBits);
+        }
+
+        return value;
+    }
+
+    // Appends the decoded bytes to out, which also serves as the history from start on. With a
+    // fileWriter all but the last historySize bytes are moved to the file as they pile up.
+    bool decodeBlock(BitReader& bitReader, std::vector<unsigned char>& out, size_t start, FileWriter* fileWriter)
+    {
+        long long bytesLeft = bitReader.Read(32);
+        SymbolDecoder literals;
+        SymbolDecoder lengths;
+        SymbolDecoder offsets;
+
+        readTable(bitReader, literals);
+        readTable(bitReader, lengths);
+        readTable(bitReader, offsets);
+
+        while (bytesLeft > 0 && bitReader.GetBitsLeft() > 0)
+        {
+            STATS_ADD(tokens, 1);
+            if (bitReader.Read(1) == 0)
+            {
+                int literal = readSymbol(bitReader, literals);
+                if (literal < 0)
+                {
+                    return false;
+                }
+
+                out.push_back((unsigned char)literal);
+                --bytesLeft;
+            }
+            else
+            {
+                int length = readValue(bitReader, lengths) + minMatchLength;
+                int offset = readValue(bitReader, offsets) + 1;
+                if (length < minMatchLength || offset <= 0 || (size_t)offset > out.size() - start)
+                {
+                    return false;
+                }
+
+                size_t position = out.size();
+                out.resize(position + length);
+
+                unsigned char* bytes = &out[position];
+                for (int i = 0; i < length; ++i)
+                {
+                    bytes[i] = bytes[i - offset];
+                }
+
+                bytesLeft -= length;
+            }
+
+            if (fileWriter != nullptr && out.size() >= (size_t)historySize + writeBlockSize)
+            {
+                size_t count = out.size() - historySize;
+                fileWriter->Write(&out[0], count);
+                out.erase(out.begin(), out.begin() + count);
+            }
+        }
+
+        return bytesLeft <= 0;
+    }
+
+    void dearchive(BitReader& bitReader, std::vector<unsigned char>& out, FileWriter* fileWriter)
+    {
+        size_t start = out.size();
+        while (bitReader.GetBitsLeft() >= 32 && decodeBlock(bitReader, out, start, fileWriter))
+        {
+        }
+
+        shannon.flushBytes(out, fileWriter, 0);
+    }
+
+public:
+    LZSSArchiver(int historySize, int viewSize, int level = LZ77Archiver::defaultLevel)
+    {
+        this->historySize = historySize;
+        this->viewSize = viewSize;
+        this->level = level;
+    }
+
+    using Archiver::Archive;
+    using Archiver::Dearchive;
+
+    void Archive(const std::string inputFile, const std::string outFile) override
+    {
+        STATS_SCOPE(stats);
+
+        std::vector<unsigned char> bytesToWrite;
+        BitWriter bitWriter(&bytesToWrite);
+        LZ77MatchFinder<> matchFinder(historySize, viewSize, LZ77Archiver::GetMaxChainLength(level, historySize));
+        FileReader* fileReader = new FileReader(inputFile);
+        FileWriter* fileWriter = new FileWriter(outFile);
+
+        if (fileReader->GetData() != nullptr)
+        {
+            matchFinder.SetSource(fileReader->GetData(), fileReader->GetSize());
+        }
+        else
+        {
+            matchFinder.SetSource(fileReader);
+        }
+
+        archive(matchFinder, bitWriter, bytesToWrite, fileWriter);
+
+        delete fileReader;
+        delete fileWriter;
+    }
+
+    void Dearchive(const std::string inputFile, const std::string outFile) override
+    {
+        STATS_SCOPE(stats);
+
+        FileReader* fileReader = new FileReader(inputFile);
+        FileWriter* fileWriter = new FileWriter(outFile);
+        BitReader* bitReader = BitReader::Open(fileReader);
+        std::vector<unsigned char> history;
+
+        dearchive(*bitReader, history, fileWriter);
+
+        delete bitReader;
+        delete fileWriter;
+        delete fileReader;
+    }
+
+    void Archive(ByteSpan input, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        BitWriter bitWriter(&out);
+        LZ77MatchFinder<> matchFinder(historySize, viewSize, LZ77Archiver::GetMaxChainLength(level, historySize));
+
+        matchFinder.SetSource(input.data, input.size);
+        archive(matchFinder, bitWriter, out, nullptr);
+    }
+
+    size_t Archive(ByteSpan input, unsigned char* out, size_t capacity) override
+    {
+        STATS_SCOPE(stats);
+
+        std::vector<unsigned char> bytesToWrite;
+        BitWriter bitWriter(out, capacity);
+        LZ77MatchFinder<> matchFinder(historySize, viewSize, LZ77Archiver::GetMaxChainLength(level, historySize));
+
+        matchFinder.SetSource(input.data, input.size);
+        archive(matchFinder, bitWriter, bytesToWrite, nullptr);
+        return bitWriter.GetBufferSize();
+    }
+
+    void Dearchive(ByteSpan input, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        BitReader bitReader(input.data, input.size, BitReader::GetPayloadBitsCount(input.data, input.size));
+        dearchive(bitReader, out, nullptr);
+    }
+
+    void ArchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        Archive(ByteSpan(bytes, size), out);
+    }
+
+    void DearchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        Dearchive(ByteSpan(bytes, size), out);
+    }
+
+    std::string GetDescription() override
+    {
+        return "LZSS + Shannon";
+    }
+
+    std::string GetShortName() override
+    {
+        return "lzss" + std::to_string(((historySize + viewSize) / 1024));
+    }
+};
@@ -0,0 +1,646 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class ThreadPool
+{
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::condition_variable done;
+    std::function<void(int)> task;
+    int tasksCount = 0;
+    int nextTask = 0;
+    int finishedTasks = 0;
+    bool stopping = false;
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true)
+        {
+            wakeUp.wait(lock, [this] { return stopping || nextTask < tasksCount; });
+
+            if (stopping)
+            {
+                return;
+            }
+
+            int index = nextTask++;
+            lock.unlock();
+            task(index);
+            lock.lock();
+
+            if (++finishedTasks == tasksCount)
+            {
+                done.notify_all();
+            }
+        }
+    }
+
+public:
+    ThreadPool(int threadsCount)
+    {
+        for (int i = 0; i < threadsCount; ++i)
+        {
+            threads.emplace_back(&ThreadPool::work, this);
+        }
+    }
+
+    // Calls task(0) ... task(count - 1) on the pool threads and waits until all of them return.
+    void Run(int count, std::function<void(int)> task)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        this->task = task;
+        tasksCount = count;
+        nextTask = 0;
+        finishedTasks = 0;
+
+        wakeUp.notify_all();
+        done.wait(lock, [this] { return finishedTasks == tasksCount; });
+
+        tasksCount = 0;
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        wakeUp.notify_all();
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+    }
+};
+
+struct BlockIndexEntry
+{
+public:
+    long long archivedOffset;
+    long long rawOffset;
+
+    BlockIndexEntry(long long archivedOffset, long long rawOffset) : archivedOffset(archivedOffset), rawOffset(rawOffset) {}
+};
+
+// Splits the input into blocks of blockSize bytes and codes them independently with the wrapped
+// archiver. Every block is stored as its raw size and archived size (32 bits each) followed by
+// the archived bytes, in input order, so the output does not depend on the number of threads.
+// The blocks are followed by an index of their archived and raw offsets (64 bits each) and the
+// number of blocks (32 bits), which lets Dearchive decode blocks independently. Blocks that do not
+// shrink are stored as they are, marked by an archived size equal to the raw size.
+class ParallelArchiver : public Archiver
+{
+private:
+    static const int blockHeaderSize = 8;
+    static const int indexEntrySize = 16;
+
+    Archiver* archiver;
+    int blockSize;
+    int threadsCount;
+
+    void archiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& archivedBlock)
+    {
+        archivedBlock.clear();
+        archiver->ArchiveBlock(bytes, size, archivedBlock);
+
+        if (archivedBlock.size() >= size)
+        {
+            archivedBlock.assign(bytes, bytes + size);
+        }
+    }
+
+    void dearchiveBlock(const unsigned char* bytes, unsigned int rawSize, unsigned int archivedSize, std::vector<unsigned char>& block)
+    {
+        if (archivedSize == rawSize)
+        {
+            block.insert(block.end(), bytes, bytes + archivedSize);
+        }
+        else
+        {
+            DearchiveBlock(bytes, archivedSize, block);
+        }
+    }
+
+    void writeBlock(FileWriter* fileWriter, unsigned int rawSize, std::vector<unsigned char>& archivedBlock)
+    {
+        std::vector<unsigned char> header;
+        writeUInt32(header, rawSize);
+        writeUInt32(header, archivedBlock.size());
+
+        fileWriter->Write(&header);
+        if (archivedBlock.size() > 0)
+        {
+            fileWriter->Write(&archivedBlock);
+        }
+    }
+
+    void appendIndex(std::vector<unsigned char>& bytes, std::vector<BlockIndexEntry>& index)
+    {
+        for (BlockIndexEntry& entry : index)
+        {
+            writeUInt64(bytes, entry.archivedOffset);
+            writeUInt64(bytes, entry.rawOffset);
+        }
+
+        writeUInt32(bytes, index.size());
+    }
+
+    void writeIndex(FileWriter* fileWriter, std::vector<BlockIndexEntry>& index)
+    {
+        std::vector<unsigned char> bytes;
+        appendIndex(bytes, index);
+        fileWriter->Write(&bytes);
+    }
+
+    // Parses the index from the last bytes of an archive; tail ends where the archive ends.
+    std::vector<BlockIndexEntry> parseIndex(const unsigned char* tail, long long tailSize)
+    {
+        std::vector<BlockIndexEntry> index;
+        if (tailSize < 4)
+        {
+            return index;
+        }
+
+        long long blocksCount = readUInt32(tail + tailSize - 4);
+        long long indexOffset = tailSize - 4 - blocksCount * indexEntrySize;
+        if (indexOffset < 0)
+        {
+            return index;
+        }
+
+        for (long long i = 0; i < blocksCount; ++i)
+        {
+            const unsigned char* entry = tail + indexOffset + i * indexEntrySize;
+            index.push_back(BlockIndexEntry(readUInt64(entry), readUInt64(entry + 8)));
+        }
+
+        return index;
+    }
+
+    std::vector<BlockIndexEntry> readIndex(FileReader* fileReader)
+    {
+        if (fileReader->GetData() != nullptr)
+        {
+            return parseIndex(fileReader->GetData(), fileReader->GetSize());
+        }
+
+        std::vector<unsigned char> bytes(4);
+        if (fileReader->GetSize() < 4)
+        {
+            return std::vector<BlockIndexEntry>();
+        }
+
+        fileReader->Seek(fileReader->GetSize() - 4);
+        fileReader->Read(&bytes, 4);
+
+        long long tailSize = readUInt32(&bytes[0]) * (long long)indexEntrySize + 4;
+        if (tailSize > fileReader->GetSize())
+        {
+            return std::vector<BlockIndexEntry>();
+        }
+
+        bytes.resize(tailSize);
+        fileReader->Seek(fileReader->GetSize() - tailSize);
+        fileReader->Read(&bytes, tailSize);
+
+        return parseIndex(&bytes[0], tailSize);
+    }
+
+    // An index read from a damaged or foreign file is rejected: the blocks must start at the
+    // beginning of the archive, follow each other and end before the index.
+    bool isValidIndex(const std::vector<BlockIndexEntry>& index, long long archiveSize)
+    {
+        if (index.empty() || index[0].archivedOffset != 0 || index[0].rawOffset != 0)
+        {
+            return false;
+        }
+
+        for (size_t i = 1; i < index.size(); ++i)
+        {
+            if (index[i].archivedOffset <= index[i - 1].archivedOffset || index[i].rawOffset <= index[i - 1].rawOffset)
+            {
+                return false;
+            }
+        }
+
+        long long indexOffset = archiveSize - 4 - (long long)index.size() * indexEntrySize;
+        return index.back().archivedOffset + blockHeaderSize <= indexOffset;
+    }
+
+    // Appends the decoded bytes of the block starting at archivedOffset of an archive in memory.
+    // Returns false if the block is cut off or does not decode to its raw size.
+    bool dearchiveBlockAt(const unsigned char* data, long long size, long long archivedOffset, std::vector<unsigned char>& block)
+    {
+        if (archivedOffset + blockHeaderSize > size)
+        {
+            return false;
+        }
+
+        unsigned int rawSize = readUInt32(data + archivedOffset);
+        unsigned int archivedSize = readUInt32(data + archivedOffset + 4);
+        if (archivedSize == 0 || archivedOffset + blockHeaderSize + archivedSize > size)
+        {
+            return false;
+        }
+
+        size_t start = block.size();
+        dearchiveBlock(data + archivedOffset + blockHeaderSize, rawSize, archivedSize, block);
+        return block.size() - start == rawSize;
+    }
+
+    // Same for an archive that is read through its stream.
+    bool dearchiveBlockAt(FileReader* fileReader, long long archivedOffset, std::vector<unsigned char>& archivedBlock, std::vector<unsigned char>& block)
+    {
+        std::vector<unsigned char> header(blockHeaderSize);
+
+        fileReader->Seek(archivedOffset);
+        if (fileReader->Read(&header, blockHeaderSize) != blockHeaderSize)
+        {
+            return false;
+        }
+
+        unsigned int rawSize = readUInt32(&header[0]);
+        unsigned int archivedSize = readUInt32(&header[4]);
+        if (archivedSize == 0 || archivedOffset + blockHeaderSize + archivedSize > fileReader->GetSize())
+        {
+            return false;
+        }
+
+        archivedBlock.resize(archivedSize);
+        if (fileReader->Read(&archivedBlock, archivedSize) != (int)archivedSize)
+        {
+            return false;
+        }
+
+        size_t start = block.size();
+        dearchiveBlock(&archivedBlock[0], rawSize, archivedSize, block);
+        return block.size() - start == rawSize;
+    }
+
+    // Raw size of the block starting at archivedOffset, or -1 if its header cannot be read.
+    long long getBlockRawSize(FileReader* fileReader, long long archivedOffset)
+    {
+        if (archivedOffset + blockHeaderSize > fileReader->GetSize())
+        {
+            return -1;
+        }
+
+        if (fileReader->GetData() != nullptr)
+        {
+            return readUInt32(fileReader->GetData() + archivedOffset);
+        }
+
+        std::vector<unsigned char> header(4);
+        fileReader->Seek(archivedOffset);
+        if (fileReader->Read(&header, 4) != 4)
+        {
+            return -1;
+        }
+
+        return readUInt32(&header[0]);
+    }
+
+    // Raw offset where block i ends: the next block's raw offset, or rawSize for the last block.
+    long long getRawEnd(const std::vector<BlockIndexEntry>& index, size_t i, long long rawSize)
+    {
+        return i + 1 < index.size() ? index[i + 1].rawOffset : rawSize;
+    }
+
+public:
+    ParallelArchiver(Archiver* archiver, int blockSize = 1024 * 1024, int threadsCount = std::thread::hardware_concurrency())
+    {
+        this->archiver = archiver;
+        this->blockSize = blockSize;
+        this->threadsCount = std::max(threadsCount, 1);
+    }
+
+    using Archiver::Archive;
+    using Archiver::Dearchive;
+
+    void Archive(const std::string inputFile, const std::string outFile) override
+    {
+        STATS_SCOPE(stats);
+
+        FileReader* fileReader = new FileReader(inputFile);
+        FileWriter* fileWriter = new FileWriter(outFile);
+        ThreadPool threadPool(threadsCount);
+
+        const unsigned char* data = fileReader->GetData();
+        int batchSize = threadsCount * 2;
+        std::vector<std::vector<unsigned char>> blocks(batchSize);
+        std::vector<const unsigned char*> blockBytes(batchSize);
+        std::vector<int> blockSizes(batchSize);
+        std::vector<std::vector<unsigned char>> archivedBlocks(batchSize);
+        std::vector<BlockIndexEntry> index;
+        long long archivedOffset = 0;
+        long long rawOffset = 0;
+        bool endOfFile = false;
+
+        while (!endOfFile)
+        {
+            int blocksCount = 0;
+            long long readOffset = rawOffset;
+            while (blocksCount < batchSize && !endOfFile)
+            {
+                int readBytes;
+
+                if (data != nullptr)
+                {
+                    readBytes = (int)std::min((long long)blockSize, fileReader->GetSize() - readOffset);
+                    blockBytes[blocksCount] = data + readOffset;
+                }
+                else
+                {
+                    std::vector<unsigned char>& block = blocks[blocksCount];
+                    block.resize(blockSize);
+                    readBytes = fileReader->Read(&block, blockSize);
+                    blockBytes[blocksCount] = &block[0];
+                }
+
+                blockSizes[blocksCount] = readBytes;
+                readOffset += readBytes;
+                endOfFile = readBytes < blockSize;
+
+                if (readBytes > 0)
+                {
+                    ++blocksCount;
+                }
+            }
+
+            threadPool.Run(blocksCount, [&](int i)
+            {
+                STATS_SCOPE(stats);
+                archiveBlock(blockBytes[i], blockSizes[i], archivedBlocks[i]);
+            });
+
+            for (int i = 0; i < blocksCount; ++i)
+            {
+                index.push_back(BlockIndexEntry(archivedOffset, rawOffset));
+                writeBlock(fileWriter, blockSizes[i], archivedBlocks[i]);
+
+                archivedOffset += blockHeaderSize + archivedBlocks[i].size();
+                rawOffset += blockSizes[i];
+            }
+        }
+
+        writeIndex(fileWriter, index);
+
+        delete fileReader;
+        delete fileWriter;
+    }
+
+    // Blocks are decoded a batch at a time and written in order. Decoding stops at the first block
+    // that fails or does not fill its part of the index, so the output is the intact prefix.
+    void Dearchive(const std::string inputFile, const std::string outFile) override
+    {
+        STATS_SCOPE(stats);
+
+        FileReader* fileReader = new FileReader(inputFile);
+        std::vector<BlockIndexEntry> index = readIndex(fileReader);
+        const unsigned char* data = fileReader->GetData();
+        FileWriter* fileWriter = new FileWriter(outFile);
+
+        long long lastRawSize = -1;
+        if (isValidIndex(index, fileReader->GetSize()))
+        {
+            lastRawSize = getBlockRawSize(fileReader, index.back().archivedOffset);
+        }
+
+        if (lastRawSize < 0)
+        {
+            delete fileWriter;
+            delete fileReader;
+            return;
+        }
+
+        long long rawSize = index.back().rawOffset + lastRawSize;
+        ThreadPool threadPool(threadsCount);
+        int batchSize = threadsCount * 2;
+        std::vector<std::vector<unsigned char>> blocks(batchSize);
+        std::vector<char> decoded(batchSize);
+        bool failed = false;
+
+        for (size_t first = 0; first < index.size() && !failed; first += batchSize)
+        {
+            int blocksCount = (int)std::min(index.size() - first, (size_t)batchSize);
+
+            threadPool.Run(blocksCount, [&](int i)
+            {
+                STATS_SCOPE(stats);
+
+                size_t j = first + i;
+                std::vector<unsigned char>& block = blocks[i];
+                bool blockDecoded;
+
+                block.clear();
+                if (data != nullptr)
+                {
+                    blockDecoded = dearchiveBlockAt(data, fileReader->GetSize(), index[j].archivedOffset, block);
+                }
+                else
+                {
+                    FileReader blockReader(inputFile);
+                    std::vector<unsigned char> archivedBlock;
+                    blockDecoded = dearchiveBlockAt(&blockReader, index[j].archivedOffset, archivedBlock, block);
+                }
+
+                decoded[i] = blockDecoded && (long long)block.size() == getRawEnd(index, j, rawSize) - index[j].rawOffset;
+            });
+
+            for (int i = 0; i < blocksCount && !failed; ++i)
+            {
+                failed = !decoded[i];
+                if (!failed)
+                {
+                    fileWriter->Write(&blocks[i]);
+                }
+            }
+        }
+
+        delete fileWriter;
+        delete fileReader;
+    }
+
+    void Archive(ByteSpan input, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        size_t start = out.size();
+        int blocksCount = (int)((input.size + blockSize - 1) / blockSize);
+        std::vector<std::vector<unsigned char>> archivedBlocks(blocksCount);
+        std::vector<BlockIndexEntry> index;
+        ThreadPool threadPool(threadsCount);
+
+        threadPool.Run(blocksCount, [&](int i)
+        {
+            STATS_SCOPE(stats);
+
+            size_t offset = (size_t)i * blockSize;
+            archiveBlock(input.data + offset, std::min((size_t)blockSize, input.size - offset), archivedBlocks[i]);
+        });
+
+        for (int i = 0; i < blocksCount; ++i)
+        {
+            size_t offset = (size_t)i * blockSize;
+            index.push_back(BlockIndexEntry(out.size() - start, offset));
+
+            writeUInt32(out, std::min((size_t)blockSize, input.size - offset));
+            writeUInt32(out, archivedBlocks[i].size());
+            out.insert(out.end(), archivedBlocks[i].begin(), archivedBlocks[i].end());
+        }
+
+        appendIndex(out, index);
+    }
+
+    // The block headers must add up to the index before the output is sized. Like the file
+    // Dearchive, appends only the blocks before the first one that fails.
+    void Dearchive(ByteSpan input, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        std::vector<BlockIndexEntry> index = parseIndex(input.data, input.size);
+        if (!isValidIndex(index, input.size))
+        {
+            return;
+        }
+
+        long long rawSize = index.back().rawOffset + readUInt32(input.data + index.back().archivedOffset);
+        for (size_t i = 0; i + 1 < index.size(); ++i)
+        {
+            if (readUInt32(input.data + index[i].archivedOffset) != getRawEnd(index, i, rawSize) - index[i].rawOffset)
+            {
+                return;
+            }
+        }
+
+        size_t start = out.size();
+        long long decodedSize = rawSize;
+        std::mutex failMutex;
+        out.resize(start + rawSize);
+
+        ThreadPool threadPool(threadsCount);
+        threadPool.Run(index.size(), [&](int i)
+        {
+            STATS_SCOPE(stats);
+
+            std::vector<unsigned char> block;
+            bool decoded = dearchiveBlockAt(input.data, input.size, index[i].archivedOffset, block);
+
+            if (!decoded || (long long)block.size() != getRawEnd(index, i, rawSize) - index[i].rawOffset)
+            {
+                std::unique_lock<std::mutex> lock(failMutex);
+                decodedSize = std::min(decodedSize, index[i].rawOffset);
+                return;
+            }
+
+            std::copy(block.begin(), block.end(), out.begin() + start + index[i].rawOffset);
+        });
+
+        out.resize(start + decodedSize);
+    }
+
+    void ArchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        archiver->ArchiveBlock(bytes, size, out);
+    }
+
+    void DearchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        archiver->DearchiveBlock(bytes, size, out);
+    }
+
+    // Decodes only the blocks overlapping [offset, offset + length).
+    bool ExtractRange(const std::string inputFile, long long offset, long long length, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        FileReader* fileReader = new FileReader(inputFile);
+        std::vector<BlockIndexEntry> index = readIndex(fileReader);
+        const unsigned char* data = fileReader->GetData();
+        std::vector<unsigned char> archivedBlock;
+        std::vector<unsigned char> block;
+
+        // The archive of empty data is only its block count of 0.
+        if (index.empty() && fileReader->GetSize() == 4 && offset == 0 && length >= 0)
+        {
+            delete fileReader;
+            return true;
+        }
+
+        if (offset < 0 || length < 0 || !isValidIndex(index, fileReader->GetSize()))
+        {
+            delete fileReader;
+            return false;
+        }
+
+        long long lastRawSize = getBlockRawSize(fileReader, index.back().archivedOffset);
+        if (lastRawSize < 0 || offset > index.back().rawOffset + lastRawSize)
+        {
+            delete fileReader;
+            return false;
+        }
+
+        int first = 0;
+        int last = (int)index.size() - 1;
+        while (first < last)
+        {
+            int middle = (first + last + 1) / 2;
+            if (index[middle].rawOffset <= offset)
+            {
+                first = middle;
+            }
+            else
+            {
+                last = middle - 1;
+            }
+        }
+
+        long long end = offset + length;
+        bool decoded = true;
+        for (int i = first; i < (int)index.size() && index[i].rawOffset < end && decoded; ++i)
+        {
+            block.clear();
+            if (data != nullptr)
+            {
+                decoded = dearchiveBlockAt(data, fileReader->GetSize(), index[i].archivedOffset, block);
+            }
+            else
+            {
+                decoded = dearchiveBlockAt(fileReader, index[i].archivedOffset, archivedBlock, block);
+            }
+
+            long long from = std::max(offset, index[i].rawOffset) - index[i].rawOffset;
+            long long to = std::min(end, index[i].rawOffset + (long long)block.size()) - index[i].rawOffset;
+            if (from < to)
+            {
+                out.insert(out.end(), block.begin() + from, block.begin() + to);
+            }
+        }
+
+        delete fileReader;
+        return decoded;
+    }
+
+    std::string GetDescription() override
+    {
+        return archiver->GetDescription() + " (parallel, " + std::to_string(blockSize / 1024) + " KB blocks)";
+    }
+
+    std::string GetShortName() override
+    {
+        return "par" + archiver->GetShortName();
+    }
+};
\ No newline at end of file
@@ -7,374 +7,872 @@
 
 typedef unsigned long long int ll;
 
+class ShannonArchiveStream;
+class ShannonDearchiveStream;
+
 class Shannon : public Archiver
 {
 private:
-    std::vector<std::pair<unsigned char, ll>>* countBytes(FileReader* fileReader)
+    friend class ShannonArchiveStream;
+    friend class ShannonDearchiveStream;
+    friend class LZSSArchiver;
+
+    static const int writeBlockSize = 64 * 1024;
+    static const int decodeTableBits = 11;
+
+    // The counts of the present symbols, into bytesCount; its storage is reused from call to call.
+    void getBytesCount(const ll* counts, std::vector<std::pair<unsigned char, ll>>& bytesCount)
     {
-        std::map<unsigned char, ll> bytesCount;
-        int readBytesCount;
-        const int blockSize = 1024;
-        std::vector<unsigned char>* bytes = new std::vector<unsigned char>(blockSize);
+        bytesCount.clear();
 
-        do
+        for (int byte = 0; byte < 256; ++byte)
         {
-            readBytesCount = fileReader->Read(bytes, blockSize);
-            for (int i = 0; i < readBytesCount; ++i)
+            if (counts[byte] > 0)
             {
-                if (bytesCount.find(bytes->at(i)) == bytesCount.end())
-                {
-                    bytesCount.insert(std::make_pair(bytes->at(i), 1));
-                }
-                else
-                {
-                    bytesCount[bytes->at(i)] += 1;
-                }
+                bytesCount.push_back(std::make_pair((unsigned char)byte, counts[byte]));
             }
         }
-        while (readBytesCount == blockSize);
+    }
 
-        std::vector<std::pair<unsigned char, ll>>* bytesCountVector = new std::vector<std::pair<unsigned char, ll>>();
-        
-        for (auto it = bytesCount.begin(); it != bytesCount.end(); it++)
-        {
-            bytesCountVector->push_back(std::make_pair(it->first, it->second));
-        }
+    void countBytes(FileReader* fileReader, std::vector<std::pair<unsigned char, ll>>& bytesCount)
+    {
+        ll counts[256] = {};
+        ::countBytes(fileReader, counts);
 
-        return bytesCountVector;
-    } 
+        getBytesCount(counts, bytesCount);
+    }
+
+    void countBytes(const unsigned char* bytes, int size, std::vector<std::pair<unsigned char, ll>>& bytesCount)
+    {
+        ll counts[256] = {};
+        ::countBytes(bytes, size, counts);
+
+        getBytesCount(counts, bytesCount);
+    }
 
     static bool comparator(const std::pair<unsigned char, ll> p1, const std::pair<unsigned char, ll> p2)
     {
         return p2.second > p1.second;
     }
 
-    std::map<unsigned char, std::vector<bool>*>* getCodes(std::vector<std::pair<unsigned char, ll>>* bytesCount)
+    // Canonical codes: symbols ordered by code length, then by value, take consecutive codes.
+    // So the lengths alone (-1 for absent symbols) are enough to rebuild every code.
+    static void getCanonicalCodes(const int* codeLengths, ll* codeBits)
     {
-        std::sort(bytesCount->begin(), bytesCount->end(), Shannon::comparator);
-        std::vector<ll>* dp = getDPVector(bytesCount);
+        ll code = 0;
+        int previousLength = 0;
 
-        int n = bytesCount->size();
-        std::queue<std::pair<int, int>> intervals;
-        intervals.push(std::make_pair(0, n - 1));
-        std::vector<std::vector<bool>*> codes(n);
-        for (int i = 0; i < n; ++i)
+        for (int length = 0; length < 64; ++length)
         {
-            codes[i] = new std::vector<bool>();
+            for (int byte = 0; byte < 256; ++byte)
+            {
+                if (codeLengths[byte] == length)
+                {
+                    code <<= (length - previousLength);
+                    previousLength = length;
+                    codeBits[byte] = code++;
+                }
+            }
         }
+    }
 
-        while (intervals.size() > 0)
+    int findMiddleIndex(const std::vector<ll>& dp, int left, int right)
+    {
+        int index = left;
+        ll prevDelta = std::abs(getSum(dp, left, left) - getSum(dp, left + 1, right));
+
+        for (int i = left + 1; i <= right - 1; ++i)
         {
-            std::pair<int, int> currInterval = intervals.front();
-            intervals.pop();
+            ll newDelta = std::abs(getSum(dp, i + 1, right) - getSum(dp, left, i));
 
-            if (currInterval.first == currInterval.second || currInterval.second < currInterval.first)
+            if (newDelta < prevDelta)
             {
-                continue; 
+                prevDelta = newDelta;
+                index = i;
             }
-            else if (currInterval.second - currInterval.first == 1)
+            else
             {
-                codes[currInterval.first]->push_back(false);
-                codes[currInterval.second]->push_back(true);
-                continue;
+                break;
             }
+        }
 
-            int index = findMiddleIndex(dp, currInterval.first, currInterval.second);
+        return index;
+    }
+
+    int getSum(const std::vector<ll>& dp, int left, int right)
+    {
+        if (left <= 0)
+        {
+            return dp[right];
+        }
+
+        return dp[right] - dp[left - 1];
+    }
+
+    struct Code
+    {
+    public:
+        ll bits;
+        int length;
+        unsigned char byte;
+    };
+
+    struct DecodeEntry
+    {
+    public:
+        unsigned int value = 0;
+        unsigned char length = 0;
+        bool isLink = false;
+    };
+
+    // Fills a lookup table indexed by the next bits of the stream; codes longer than
+    // decodeTableBits continue in linked sub-tables. Returns the width of the table built.
+    int buildDecodeTable(std::vector<DecodeEntry>& table, std::vector<Code>& codes, int consumedBits)
+    {
+        int maxLength = 0;
+        for (Code& code : codes)
+        {
+            maxLength = std::max(maxLength, code.length);
+        }
 
-            for (int i = currInterval.first; i <= index; ++i)
+        int tableBits = std::min((int)decodeTableBits, maxLength - consumedBits);
+        size_t start = table.size();
+        table.resize(start + (1 << tableBits));
+
+        std::map<unsigned int, std::vector<Code>> links;
+        for (Code& code : codes)
+        {
+            int restBits = code.length - consumedBits;
+
+            if (restBits <= tableBits)
             {
-                codes[i]->push_back(false);
+                unsigned int index = (unsigned int)(code.bits & ((1ULL << restBits) - 1)) << (tableBits - restBits);
+                for (unsigned int i = 0; i < (1U << (tableBits - restBits)); ++i)
+                {
+                    table[start + index + i].value = code.byte;
+                    table[start + index + i].length = restBits;
+                }
             }
-
-            for (int i = index + 1; i <= currInterval.second; ++i)
+            else
             {
-                codes[i]->push_back(true);
+                links[(unsigned int)(code.bits >> (restBits - tableBits)) & ((1U << tableBits) - 1)].push_back(code);
             }
-
-            intervals.push(std::make_pair(currInterval.first, index));
-            intervals.push(std::make_pair(index + 1, currInterval.second));
         }
 
-        std::map<unsigned char, std::vector<bool>*>* charCodes = new std::map<unsigned char, std::vector<bool>*>();
-        for (int i = 0; i < bytesCount->size(); ++i)
+        for (auto it = links.begin(); it != links.end(); it++)
         {
-            charCodes->insert(std::make_pair(bytesCount->at(i).first, codes[i]));
+            unsigned int subTableStart = table.size();
+            int subTableBits = buildDecodeTable(table, it->second, consumedBits + tableBits);
+
+            table[start + it->first].value = subTableStart;
+            table[start + it->first].length = subTableBits;
+            table[start + it->first].isLink = true;
         }
 
-        return charCodes;
+        return tableBits;
     }
 
-    int findMiddleIndex(std::vector<ll>* dp, int left, int right)
+    void getDPVector(const std::vector<std::pair<unsigned char, ll>>& bytesCount, std::vector<ll>& dp)
     {
-        int index = left;
-        ll prevDelta = std::abs(getSum(dp, left, left) - getSum(dp, left + 1, right));
+        dp.resize(bytesCount.size());
+        dp[0] = bytesCount[0].second;
 
-        for (int i = left + 1; i <= right - 1; ++i)
+        for (size_t i = 1; i < bytesCount.size(); ++i)
         {
-            ll newDelta = std::abs(getSum(dp, i + 1, right) - getSum(dp, left, i));
+            dp[i] = dp[i - 1] + bytesCount[i].second;
+        }
+    }
 
-            if (newDelta < prevDelta)
+    // The table holds only the code lengths, in fields of up to 7 bits.
+    void writeCodeLengths(const int* codeLengths, BitWriter& bitWriter)
+    {
+        writeSymbolValues(codeLengths, 3, bitWriter);
+    }
+
+    std::vector<Code> readCodes(BitReader& bitReader)
+    {
+        int codeLengths[256];
+        ll codeBits[256];
+
+        readSymbolValues(bitReader, 3, codeLengths);
+        std::vector<Code> codes;
+
+        getCanonicalCodes(codeLengths, codeBits);
+        for (int byte = 0; byte < 256; ++byte)
+        {
+            if (codeLengths[byte] >= 0)
             {
-                prevDelta = newDelta;
-                index = i;
+                Code code;
+                code.bits = codeBits[byte];
+                code.length = codeLengths[byte];
+                code.byte = (unsigned char)byte;
+                codes.push_back(code);
             }
-            else
+        }
+
+        return codes;
+    }
+
+    // Returns the next decoded byte, or -1 when the stream ends before a whole code.
+    int decodeSymbol(BitReader& bitReader, std::vector<DecodeEntry>& decodeTable, int primaryBits)
+    {
+        int tableBits = primaryBits;
+        DecodeEntry* entry = &decodeTable[bitReader.Peek(tableBits)];
+
+        while (entry->isLink)
+        {
+            if ((unsigned long long)tableBits > bitReader.GetBitsLeft())
             {
-                break;
+                return -1;
             }
+
+            bitReader.Skip(tableBits);
+            tableBits = entry->length;
+            entry = &decodeTable[entry->value + bitReader.Peek(tableBits)];
         }
 
-        return index;
+        if (entry->length == 0 || entry->length > bitReader.GetBitsLeft())
+        {
+            return -1;
+        }
+
+        bitReader.Skip(entry->length);
+        return entry->value;
     }
 
-    int getSum(std::vector<ll>* dp, int left, int right)
+    void flushBytes(std::vector<unsigned char>& bytes, FileWriter* fileWriter, size_t minSize)
     {
-        if (left <= 0)
+        if (fileWriter != nullptr && bytes.size() >= minSize && bytes.size() > 0)
         {
-            return dp->at(right);
+            fileWriter->Write(&bytes);
+            bytes.clear();
         }
+    }
+
+    void encodeBytes(const unsigned char* bytes, size_t size, ll* codeBits, int* codeLengths, BitWriter& bitWriter, std::vector<unsigned char>& bytesToWrite, FileWriter* fileWriter)
+    {
+        STATS_ADD(tokens, size);
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            bitWriter.Write(codeBits[bytes[i]], codeLengths[bytes[i]]);
 
-        return dp->at(right) - dp->at(left - 1);
+            if ((i & 0xFFF) == 0)
+            {
+                flushBytes(bytesToWrite, fileWriter, writeBlockSize);
+            }
+        }
     }
 
-    std::vector<ll>* getDPVector(std::vector<std::pair<unsigned char, ll>>* bytesCount)
+    // Whole-input mode has no sizes to tell how many times a zero-length code repeats, so it asks
+    // for codes of at least one bit.
+    void writeTable(std::vector<std::pair<unsigned char, ll>>& bytesCount, BitWriter& bitWriter, ll* codeBits, int* codeLengths, int minLength = 0)
     {
-        std::vector<ll>* dp = new std::vector<ll>();
-        dp->push_back(bytesCount->at(0).second);
-        
-        for (int i = 1; i < bytesCount->size(); ++i)
+        getCodeLengths(bytesCount, codeLengths);
+
+        for (int byte = 0; byte < 256; ++byte)
         {
-            dp->push_back(dp->at(i - 1) + bytesCount->at(i).second);
+            if (codeLengths[byte] >= 0)
+            {
+                codeLengths[byte] = std::max(codeLengths[byte], minLength);
+            }
         }
 
-        return dp;
+        getCanonicalCodes(codeLengths, codeBits);
+        writeCodeLengths(codeLengths, bitWriter);
     }
 
-public:
-    void Archive(const std::string inputFile, const std::string outFile) override
+    // A block is written as its size (32 bits), its own code table and its codes. The counts are
+    // passed in so that their storage is reused by all the blocks.
+    void encodeBlock(const unsigned char* bytes, int size, std::vector<std::pair<unsigned char, ll>>& bytesCount, BitWriter& bitWriter, std::vector<unsigned char>& bytesToWrite, FileWriter* fileWriter)
     {
-        FileReader* fileReader = new FileReader(inputFile);
-        std::map<unsigned char, std::vector<bool>*>* codes = getCodes(countBytes(fileReader));
-        
-        std::vector<bool> resBits;
+        if (size == 0)
+        {
+            return;
+        }
 
-        int readBytes;
-        FileWriter* fileWriter = new FileWriter(outFile);
-        std::queue<bool> bits;
-        std::vector<unsigned char> tempBytesToWrite;
+        ll codeBits[256];
+        int codeLengths[256];
+
+        countBytes(bytes, size, bytesCount);
 
-        std::vector<bool> sizeBits = getBitsFromByte((unsigned char)codes->size()); 
-        for (int i = 0; i < sizeBits.size(); ++i)
+        bitWriter.Write(size, 32);
+        writeTable(bytesCount, bitWriter, codeBits, codeLengths);
+        encodeBytes(bytes, size, codeBits, codeLengths, bitWriter, bytesToWrite, fileWriter);
+    }
+
+    // A block of size 0 marks a sync point that Flush writes into a stream.
+    void writeSyncPoint(BitWriter& bitWriter)
+    {
+        bitWriter.Write(0, 32);
+        bitWriter.WriteSyncPadding();
+    }
+
+    // The decode table is passed in so that its storage is reused by all the blocks. Returns false
+    // if the block is not whole.
+    bool decodeBlock(BitReader& bitReader, std::vector<DecodeEntry>& decodeTable, std::vector<unsigned char>& out, FileWriter* fileWriter)
+    {
+        unsigned int blockBytes = bitReader.Read(32);
+        if (blockBytes == 0)
         {
-            bits.push(sizeBits[i]);
+            int paddingBits = bitReader.GetSyncPaddingBits();
+            if ((unsigned long long)paddingBits > bitReader.GetBitsLeft())
+            {
+                return false;
+            }
+
+            bitReader.Read(paddingBits);
+            return true;
         }
 
-        for (auto it = codes->begin(); it != codes->end(); it++)
+        std::vector<Code> codes = readCodes(bitReader);
+        if (codes.empty())
         {
-            sizeBits = getBitsFromByte(it->first);
+            return false;
+        }
+
+        decodeTable.clear();
+        int primaryBits = buildDecodeTable(decodeTable, codes, 0);
 
-            for (int i = 0; i < sizeBits.size(); ++i)
+        for (unsigned int i = 0; i < blockBytes; ++i)
+        {
+            int byte = primaryBits == 0 ? codes[0].byte : decodeSymbol(bitReader, decodeTable, primaryBits);
+            if (byte < 0)
             {
-                bits.push(sizeBits[i]);
+                return false;
             }
 
-            sizeBits = getBitsFromByte(it->second->size());
+            STATS_ADD(tokens, 1);
+            out.push_back((unsigned char)byte);
+            flushBytes(out, fileWriter, writeBlockSize);
+        }
+
+        return true;
+    }
+
+    // Codes input that is entirely in memory; with a null fileWriter the result stays in bytesToWrite.
+    void archiveMemory(const unsigned char* bytes, size_t size, BitWriter& bitWriter, std::vector<unsigned char>& bytesToWrite, FileWriter* fileWriter)
+    {
+        std::vector<std::pair<unsigned char, ll>> bytesCount;
 
-            for (int i = 0; i < sizeBits.size(); ++i)
+        if (blockSize > 0)
+        {
+            for (size_t offset = 0; offset < size; offset += blockSize)
             {
-                bits.push(sizeBits[i]);
+                encodeBlock(bytes + offset, (int)std::min((size_t)blockSize, size - offset), bytesCount, bitWriter, bytesToWrite, fileWriter);
             }
+        }
+        else if (size > 0)
+        {
+            ll codeBits[256];
+            int codeLengths[256];
+
+            countBytes(bytes, size, bytesCount);
+            writeTable(bytesCount, bitWriter, codeBits, codeLengths, 1);
+            encodeBytes(bytes, size, codeBits, codeLengths, bitWriter, bytesToWrite, fileWriter);
+        }
+
+        bitWriter.Close();
+        flushBytes(bytesToWrite, fileWriter, 0);
+    }
+
+    // Codes a file that could not be mapped through its stream. Block mode reads the input
+    // only once, so it also works on pipes.
+    void archiveStream(FileReader* fileReader, BitWriter& bitWriter, std::vector<unsigned char>& bytesToWrite, FileWriter* fileWriter)
+    {
+        std::vector<std::pair<unsigned char, ll>> bytesCount;
+
+        if (blockSize > 0)
+        {
+            std::vector<unsigned char> block(blockSize);
+            int readBytes;
 
-            for (int i = 0; i < it->second->size(); ++i)
+            while ((readBytes = fileReader->Read(&block, blockSize)) > 0)
             {
-                bits.push(it->second->at(i));
+                encodeBlock(&block[0], readBytes, bytesCount, bitWriter, bytesToWrite, fileWriter);
+
+                if (readBytes < blockSize)
+                {
+                    break;
+                }
             }
         }
-
-        int sz = codes->size();
-        delete fileReader;
-        fileReader = new FileReader(inputFile);
-        do
+        else
         {
-            unsigned char byte = fileReader->ReadNextChar(readBytes);
-    
-            if (readBytes > 0)
+            countBytes(fileReader, bytesCount);
+
+            if (bytesCount.size() > 0)
             {
-                for (int j = 0; j < codes->at(byte)->size(); ++j)
+                std::vector<unsigned char> block(writeBlockSize);
+                ll codeBits[256];
+                int codeLengths[256];
+                int readBytes;
+
+                writeTable(bytesCount, bitWriter, codeBits, codeLengths, 1);
+
+                fileReader->Reset();
+                while ((readBytes = fileReader->Read(&block, writeBlockSize)) > 0)
                 {
-                    bits.push(codes->at(byte)->at(j));
+                    encodeBytes(&block[0], readBytes, codeBits, codeLengths, bitWriter, bytesToWrite, fileWriter);
                 }
             }
+        }
+
+        bitWriter.Close();
+        flushBytes(bytesToWrite, fileWriter, 0);
+    }
 
-            sz = bits.size();
-            tempBytesToWrite.clear();
-            while (bits.size() >= 8)
+    void dearchive(BitReader& bitReader, std::vector<unsigned char>& out, FileWriter* fileWriter)
+    {
+        if (blockSize > 0)
+        {
+            std::vector<DecodeEntry> decodeTable;
+
+            while (bitReader.GetBitsLeft() >= 32 && decodeBlock(bitReader, decodeTable, out, fileWriter))
             {
-                tempBytesToWrite.push_back(getByteFromQueue(&bits));
             }
+        }
+        else if (bitReader.GetBitsLeft() > 0)
+        {
+            std::vector<Code> codes = readCodes(bitReader);
+            std::vector<DecodeEntry> decodeTable;
+            int primaryBits = buildDecodeTable(decodeTable, codes, 0);
 
-            if (tempBytesToWrite.size() > 0)
+            while (primaryBits > 0 && bitReader.GetBitsLeft() > 0)
             {
-                fileWriter->Write(&tempBytesToWrite);
+                int byte = decodeSymbol(bitReader, decodeTable, primaryBits);
+                if (byte < 0)
+                {
+                    break;
+                }
+
+                STATS_ADD(tokens, 1);
+                out.push_back((unsigned char)byte);
+                flushBytes(out, fileWriter, writeBlockSize);
             }
         }
-        while (readBytes > 0);
 
-        tempBytesToWrite.clear();
-        unsigned char lastByteSize = bits.size();
-        unsigned char lastByte = 0;
-        for (int i = 7; i >= 0; --i)
+        flushBytes(out, fileWriter, 0);
+    }
+
+protected:
+    int blockSize;
+
+    // Shannon-Fano split of the symbols sorted by count; each split adds a bit to the code of every
+    // symbol in the interval, so only the resulting lengths are kept.
+    virtual void getCodeLengths(std::vector<std::pair<unsigned char, ll>>& bytesCount, int* codeLengths)
+    {
+        std::sort(bytesCount.begin(), bytesCount.end(), Shannon::comparator);
+        std::vector<ll> dp;
+        getDPVector(bytesCount, dp);
+
+        int n = bytesCount.size();
+        std::vector<int> lengths(n);
+        std::queue<std::pair<int, int>> intervals;
+        intervals.push(std::make_pair(0, n - 1));
+
+        while (intervals.size() > 0)
         {
-            if (bits.empty())
+            std::pair<int, int> currInterval = intervals.front();
+            intervals.pop();
+
+            if (currInterval.first == currInterval.second || currInterval.second < currInterval.first)
             {
-                break;
+                continue; 
+            }
+            else if (currInterval.second - currInterval.first == 1)
+            {
+                ++lengths[currInterval.first];
+                ++lengths[currInterval.second];
+                continue;
             }
 
-            if (bits.front())
+            int index = findMiddleIndex(dp, currInterval.first, currInterval.second);
+
+            for (int i = currInterval.first; i <= currInterval.second; ++i)
             {
-                lastByte += (int)(std::pow(2, i));
+                ++lengths[i];
             }
 
-            bits.pop();
+            intervals.push(std::make_pair(currInterval.first, index));
+            intervals.push(std::make_pair(index + 1, currInterval.second));
+        }
+
+        std::fill(codeLengths, codeLengths + 256, -1);
+        for (int i = 0; i < n; ++i)
+        {
+            codeLengths[bytesCount[i].first] = lengths[i];
+        }
+    }
+
+public:
+    // With blockSize == 0 the whole file is coded with one table in two passes over the input;
+    // otherwise it is coded in independent blocks of blockSize bytes in a single pass.
+    Shannon(int blockSize = 0)
+    {
+        this->blockSize = blockSize;
+    }
+
+    using Archiver::Archive;
+    using Archiver::Dearchive;
+
+    void Archive(const std::string inputFile, const std::string outFile) override
+    {
+        STATS_SCOPE(stats);
+
+        FileReader* fileReader = new FileReader(inputFile);
+        FileWriter* fileWriter = new FileWriter(outFile);
+        std::vector<unsigned char> bytesToWrite;
+        BitWriter bitWriter(&bytesToWrite);
+
+        if (fileReader->GetData() != nullptr)
+        {
+            archiveMemory(fileReader->GetData(), fileReader->GetSize(), bitWriter, bytesToWrite, fileWriter);
         }
+        else if (blockSize == 0 && fileReader->GetSize() < 0)
+        {
+            // Whole-input mode reads the input twice, once to count the bytes and once to code them.
+            // Input that can only be read once, such as a pipe, is collected in memory first.
+            std::vector<unsigned char> input;
+            std::vector<unsigned char> block(writeBlockSize);
+            int readBytes;
 
-        tempBytesToWrite.push_back(lastByte);
-        tempBytesToWrite.push_back(lastByteSize);
+            while ((readBytes = fileReader->Read(&block, writeBlockSize)) > 0)
+            {
+                input.insert(input.end(), block.begin(), block.begin() + readBytes);
+            }
 
-        fileWriter->Write(&tempBytesToWrite);
+            archiveMemory(input.data(), input.size(), bitWriter, bytesToWrite, fileWriter);
+        }
+        else
+        {
+            archiveStream(fileReader, bitWriter, bytesToWrite, fileWriter);
+        }
 
         delete fileReader;
         delete fileWriter;
     }
 
-    struct CodeNode
+    void Dearchive(const std::string filePath, const std::string dearchiveFilePath) override
     {
-    public:
-        CodeNode* left = nullptr;
-        CodeNode* right = nullptr;
-        bool isCode = false;
-        unsigned char byte;
-    };
+        STATS_SCOPE(stats);
 
-    void Dearchive(const std::string filePath, const std::string dearchiveFilePath) override
+        FileReader* fileReader = new FileReader(filePath);
+        FileWriter* fileWriter = new FileWriter(dearchiveFilePath);
+        BitReader* bitReader = BitReader::Open(fileReader);
+        std::vector<unsigned char> dearchivedBytes;
+        dearchivedBytes.reserve(writeBlockSize);
+
+        dearchive(*bitReader, dearchivedBytes, fileWriter);
+
+        delete bitReader;
+        delete fileWriter;
+        delete fileReader;
+    }
+
+    void Archive(ByteSpan input, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        BitWriter bitWriter(&out);
+        archiveMemory(input.data, input.size, bitWriter, out, nullptr);
+    }
+
+    size_t Archive(ByteSpan input, unsigned char* out, size_t capacity) override
+    {
+        STATS_SCOPE(stats);
+
+        std::vector<unsigned char> bytesToWrite;
+        BitWriter bitWriter(out, capacity);
+
+        archiveMemory(input.data, input.size, bitWriter, bytesToWrite, nullptr);
+        return bitWriter.GetBufferSize();
+    }
+
+    void Dearchive(ByteSpan input, std::vector<unsigned char>& out) override
     {
-        FileReader* fr = new FileReader(filePath);
-        std::vector<bool> bits = fr->ReadAll(filePath);
+        STATS_SCOPE(stats);
 
-        std::vector<bool> tempBits;
+        BitReader bitReader(input.data, input.size, BitReader::GetPayloadBitsCount(input.data, input.size));
+        dearchive(bitReader, out, nullptr);
+    }
+
+    void ArchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        BitWriter bitWriter(&out);
+        std::vector<std::pair<unsigned char, ll>> bytesCount;
+
+        encodeBlock(bytes, (int)size, bytesCount, bitWriter, out, nullptr);
+        bitWriter.Close();
+    }
 
-        for (int i = 0; i < 8; ++i)
+    void DearchiveBlock(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(stats);
+
+        BitReader bitReader(bytes, size, BitReader::GetPayloadBitsCount(bytes, size));
+        std::vector<DecodeEntry> decodeTable;
+
+        while (bitReader.GetBitsLeft() >= 32 && decodeBlock(bitReader, decodeTable, out, nullptr))
         {
-            tempBits.push_back(bits[i]);
         }
+    }
+
+    ArchiverStream* CreateArchiveStream() override;
+    ArchiverStream* CreateDearchiveStream() override;
 
-        int encodedBytesCount = getByteFromBits(tempBits);
-        if (encodedBytesCount == 0)
+    std::string GetDescription() override
+    {
+        if (blockSize > 0)
         {
-            encodedBytesCount = 256;
+            return "Shannon (" + std::to_string(blockSize / 1024) + " KB blocks)";
         }
 
-        int bitsIndex = 8;
+        return "Shannon";
+    }
 
-        CodeNode* root = new CodeNode();
-        std::map<unsigned char, std::vector<bool>> codes;
-        for (int i = 0; i < encodedBytesCount; ++i)
+    std::string GetShortName() override
+    {
+        if (blockSize > 0)
         {
-            tempBits.clear();
-            for (int j = 0; j < 8; ++j)
-            {
-                tempBits.push_back(bits[bitsIndex++]);
-            }
+            return "shanb" + std::to_string(blockSize / 1024);
+        }
+
+        return "shan";
+    }
+};
 
-            unsigned char byte = getByteFromBits(tempBits);
+// Only block mode has streams: a single table for the whole input could only be written after all
+// of it had been seen. Without Flush the output is what Shannon(blockSize) writes.
+class ShannonArchiveStream : public ArchiverStream
+{
+private:
+    Shannon* shannon;
+    int blockSize;
+    std::vector<unsigned char> block;
+    std::vector<std::pair<unsigned char, ll>> bytesCount;
+    std::vector<unsigned char> bytesToWrite;
+    BitWriter bitWriter;
+
+    void encodeBlock()
+    {
+        shannon->encodeBlock(block.data(), (int)block.size(), bytesCount, bitWriter, bytesToWrite, nullptr);
+        block.clear();
+    }
 
-            tempBits.clear();
-            for (int j = 0; j < 8; ++j)
-            {
-                tempBits.push_back(bits[bitsIndex++]);
-            }
+    void moveBytes(std::vector<unsigned char>& out)
+    {
+        out.insert(out.end(), bytesToWrite.begin(), bytesToWrite.end());
+        bytesToWrite.clear();
+    }
 
-            unsigned char codeLength = getByteFromBits(tempBits);
+public:
+    ShannonArchiveStream(Shannon* shannon, int blockSize) : shannon(shannon), blockSize(blockSize), bitWriter(&bytesToWrite)
+    {
+        block.reserve(blockSize);
+    }
 
-            std::vector<bool> code;
-            for (unsigned char j = 0; j < codeLength; ++j)
-            {
-                code.push_back(bits[bitsIndex++]);
-            }
+    void Update(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(shannon->stats);
 
-            CodeNode* currNode = root;
+        while (size > 0)
+        {
+            size_t count = std::min(size, (size_t)blockSize - block.size());
+            block.insert(block.end(), bytes, bytes + count);
+            bytes += count;
+            size -= count;
 
-            for (int j = 0; j < code.size(); ++j)
+            if (block.size() == (size_t)blockSize)
             {
-                if (code[j])
-                {
-                    if (currNode->right == nullptr)
-                    {
-                        currNode->right = new CodeNode();
-                        currNode = currNode->right;
-                    }
-                    else
-                    {
-                        currNode = currNode->right;
-                    }
-                }
-                else
-                {
-                    if (currNode->left == nullptr)
-                    {
-                        currNode->left = new CodeNode();
-                        currNode = currNode->left;
-                    }
-                    else
-                    {
-                        currNode = currNode->left;
-                    }
-                }
+                encodeBlock();
+                moveBytes(out);
             }
+        }
+    }
 
-            currNode->isCode = true;
-            currNode->byte = byte;
+    // Ends the current block early and follows it with a sync point, so that the receiver can
+    // decode all of it from what has been written so far.
+    void Flush(std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(shannon->stats);
+
+        encodeBlock();
+        shannon->writeSyncPoint(bitWriter);
+        moveBytes(out);
+    }
+
+    void Finish(std::vector<unsigned char>& out) override
+    {
+        STATS_SCOPE(shannon->stats);
+
+        encodeBlock();
+        bitWriter.Close();
+        moveBytes(out);
+    }
+};
+
+class ShannonDearchiveStream : public ArchiverStream
+{
+private:
+    Shannon* shannon;
+    BitStreamBuffer input;
+    unsigned int blockBytesLeft = 0;
+    std::vector<Shannon::Code> codes;
+    std::vector<Shannon::DecodeEntry> decodeTable;
+    int primaryBits = 0;
+    int maxLength = 0;
+    int syncBitsLeft = 0;
+    bool failed = false;
+
+    // Skips what has arrived of the padding of a sync point; false while some of it is still to come.
+    bool skipSyncPadding(BitReader* bitReader)
+    {
+        int count = (int)std::min((unsigned long long)syncBitsLeft, bitReader->GetBitsLeft());
+        if (count > 0)
+        {
+            bitReader->Read(count);
+            syncBitsLeft -= count;
         }
 
-        tempBits.clear();
-        for (int i = bits.size() - 8; i < bits.size(); ++i)
+        return syncBitsLeft == 0;
+    }
+
+    // Reads the size and code table of the next block, or leaves the reader untouched when
+    // they have not been received in full yet. A header that no block of this size could have
+    // stops the decoding for good, since the input is not a stream of this archiver.
+    bool readBlockHeader(BitReader* bitReader)
+    {
+        if (bitReader->GetBitsLeft() < 32)
         {
-            tempBits.push_back(bits[i]);
+            return false;
         }
 
-        unsigned char meaningfullBitsInPreLastByte = getByteFromBits(tempBits);
+        BitReader headerReader = *bitReader;
+        unsigned int blockBytes = headerReader.Read(32);
 
-        CodeNode* currNode = root;
-        std::vector<unsigned char> dearchivedBytes;
-        while (bitsIndex < bits.size() - (8 - meaningfullBitsInPreLastByte) - 8)
+        if (blockBytes == 0)
+        {
+            *bitReader = headerReader;
+            syncBitsLeft = bitReader->GetSyncPaddingBits();
+            return true;
+        }
+
+        if (blockBytes > (unsigned int)shannon->blockSize)
+        {
+            failed = true;
+            return false;
+        }
+
+        if (headerReader.GetBitsLeft() < 8)
         {
-            if (bits[bitsIndex++])
+            return false;
+        }
+
+        std::vector<Shannon::Code> blockCodes = shannon->readCodes(headerReader);
+
+        if (headerReader.GetBitsLeft() > bitReader->GetBitsLeft())
+        {
+            return false;
+        }
+
+        if (blockCodes.empty())
+        {
+            failed = true;
+            return false;
+        }
+
+        *bitReader = headerReader;
+        blockBytesLeft = blockBytes;
+        codes = blockCodes;
+        decodeTable.clear();
+        primaryBits = shannon->buildDecodeTable(decodeTable, codes, 0);
+        maxLength = 0;
+
+        for (Shannon::Code& code : codes)
+        {
+            maxLength = std::max(maxLength, code.length);
+        }
+
+        return true;
+    }
+
+    void decode(bool finished, std::vector<unsigned char>& out)
+    {
+        BitReader* bitReader = input.Open(finished);
+
+        while (!failed && skipSyncPadding(bitReader) && (blockBytesLeft > 0 || readBlockHeader(bitReader)))
+        {
+            if (blockBytesLeft == 0)
             {
-                currNode = currNode->right;
+                continue;
             }
-            else
+
+            int byte;
+            if (primaryBits == 0)
             {
-                currNode = currNode->left;
+                byte = codes[0].byte;
             }
-
-            if (currNode->isCode)
+            else if (finished || bitReader->GetBitsLeft() >= (unsigned long long)maxLength)
             {
-                dearchivedBytes.push_back(currNode->byte);
-                currNode = root;
+                byte = shannon->decodeSymbol(*bitReader, decodeTable, primaryBits);
+                if (byte < 0)
+                {
+                    blockBytesLeft = 0;
+                    break;
+                }
             }
+            else
+            {
+                // The last code received may be cut off, so it is only taken if it is whole.
+                BitReader symbolReader = *bitReader;
+                byte = shannon->decodeSymbol(symbolReader, decodeTable, primaryBits);
+                if (byte < 0)
+                {
+                    break;
+                }
+
+                *bitReader = symbolReader;
+            }
+
+            STATS_ADD(tokens, 1);
+            out.push_back((unsigned char)byte);
+            --blockBytesLeft;
         }
 
-        FileWriter* fw = new FileWriter(dearchiveFilePath);
-        fw->Write(&dearchivedBytes);    
+        input.Close(bitReader);
     }
 
-    std::string GetDescription() override
+public:
+    ShannonDearchiveStream(Shannon* shannon) : shannon(shannon) {}
+
+    void Update(const unsigned char* bytes, size_t size, std::vector<unsigned char>& out) override
     {
-        return "Shannon";
+        STATS_SCOPE(shannon->stats);
+
+        input.Append(bytes, size);
+        decode(false, out);
     }
 
-    std::string GetShortName() override
+    // Everything that can be decoded already is after each Update.
+    void Flush(std::vector<unsigned char>&) override {}
+
+    void Finish(std::vector<unsigned char>& out) override
     {
-        return "shan";
+        STATS_SCOPE(shannon->stats);
+
+        decode(true, out);
     }
-};
\ No newline at end of file
+};
+
+ArchiverStream* Shannon::CreateArchiveStream()
+{
+    return blockSize > 0 ? new ShannonArchiveStream(this, blockSize) : nullptr;
+}
+
+ArchiverStream* Shannon::CreateDearchiveStream()
+{
+    return blockSize > 0 ? new ShannonDearchiveStream(this) : nullptr;
+}
@@ -1,218 +1,716 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
-#include <queue>
+#include <cstring>
+#include <algorithm>
 #include "math.h"
 
-std::vector<bool> getBitsFromByte(unsigned char byte)
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+void writeUInt32(std::vector<unsigned char>& bytes, unsigned int value)
+{
+    bytes.push_back((unsigned char)(value >> 24));
+    bytes.push_back((unsigned char)(value >> 16));
+    bytes.push_back((unsigned char)(value >> 8));
+    bytes.push_back((unsigned char)value);
+}
+
+unsigned int readUInt32(const unsigned char* bytes)
+{
+    return ((unsigned int)bytes[0] << 24) | ((unsigned int)bytes[1] << 16) | ((unsigned int)bytes[2] << 8) | bytes[3];
+}
+
+void writeUInt64(std::vector<unsigned char>& bytes, unsigned long long value)
+{
+    writeUInt32(bytes, (unsigned int)(value >> 32));
+    writeUInt32(bytes, (unsigned int)value);
+}
+
+unsigned long long readUInt64(const unsigned char* bytes)
 {
-    std::vector<bool> bits;
+    return ((unsigned long long)readUInt32(bytes) << 32) | readUInt32(bytes + 4);
+}
 
-    for (int i = 7; i >= 0; --i)
+class FileReader
+{
+private:
+    std::ifstream* fileStream;
+    std::string filePath;
+    long long size;
+    const unsigned char* data = nullptr;
+
+public:
+    FileReader(const std::string filePath)
     {
-        unsigned char p = (unsigned char)pow(2, i);
-        if (p <= byte)
+        this->filePath = filePath;
+        fileStream = new std::ifstream(filePath, std::ios::binary);
+        fileStream->seekg(0, std::ios::end);
+        size = fileStream->tellg();
+
+        if (size >= 0)
         {
-            bits.push_back(true);
-            byte -= p;
+            fileStream->seekg(0, std::ios::beg);
         }
         else
         {
-            bits.push_back(false);
+            fileStream->clear();
         }
     }
 
-    return bits;
-} 
+    void Reset() 
+    {
+        Seek(0);
+    }
+
+    void Seek(long long position)
+    {
+        fileStream->clear();
+        fileStream->seekg(position, std::ios::beg);
+    }
+
+    long long GetSize()
+    {
+        return size;
+    }
+
+    // Maps the whole file into memory on first use. Returns nullptr when that is not possible
+    // (pipes, empty files, platforms without mmap); the stream methods keep working either way.
+    const unsigned char* GetData()
+    {
+#ifndef _WIN32
+        if (data == nullptr && size > 0)
+        {
+            int descriptor = open(filePath.c_str(), O_RDONLY);
+            if (descriptor >= 0)
+            {
+                void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+                close(descriptor);
+
+                if (mapping != MAP_FAILED)
+                {
+                    madvise(mapping, size, MADV_SEQUENTIAL);
+                    data = (const unsigned char*)mapping;
+                }
+            }
+        }
+#endif
+        return data;
+    }
 
-unsigned char getByteFromBits(std::vector<bool> bits)
+    int Read(std::vector<unsigned char>* bytes, int size)
+    {
+        return Read(&(bytes->at(0)), size);
+    }
+
+    int Read(unsigned char* bytes, int size)
+    {
+        STATS_TIMER(ioSeconds);
+        STATS_ADD(readCalls, 1);
+
+        fileStream->read((char *)bytes, size);
+        return fileStream->gcount();
+    }
+
+    unsigned char ReadNextChar(int& readBytes)
+    {
+        unsigned char nextChar = 0;
+        fileStream->read((char*)(&nextChar), 1);
+        readBytes = fileStream->gcount();
+        
+        return nextChar;
+    }
+
+    ~FileReader()
+    {
+#ifndef _WIN32
+        if (data != nullptr)
+        {
+            munmap((void*)data, size);
+        }
+#endif
+        fileStream->close();
+        delete fileStream;
+    }
+};
+
+// Defined here since it reads the archive through FileReader.
+bool Archiver::ExtractRange(const std::string inputFile, long long offset, long long length, std::vector<unsigned char>& out)
 {
-    unsigned char byte = 0;
-    for (int i = 0; i < bits.size(); ++i)
+    FileReader* fileReader = new FileReader(inputFile);
+    long long size = fileReader->GetSize();
+    if (size < 0 || offset < 0 || length < 0)
+    {
+        delete fileReader;
+        return false;
+    }
+
+    std::vector<unsigned char> archived;
+    ByteSpan input(fileReader->GetData(), (size_t)size);
+    if (input.data == nullptr)
     {
-        if (bits[i])
+        archived.resize(size);
+        if (size > 0 && fileReader->Read(&archived, (int)size) != size)
         {
-            byte += (unsigned char)pow(2, 7 - i);
+            delete fileReader;
+            return false;
         }
+
+        input = ByteSpan(archived);
+    }
+
+    std::vector<unsigned char> dearchived;
+    Dearchive(input, dearchived);
+    delete fileReader;
+
+    if (offset > (long long)dearchived.size())
+    {
+        return false;
     }
 
-    return byte;
+    long long count = std::min(length, (long long)dearchived.size() - offset);
+    out.insert(out.end(), dearchived.begin() + offset, dearchived.begin() + offset + count);
+    return true;
 }
 
-std::vector<bool> getBitsFromInt(int num, int bitsCount)
+// Adds the number of occurrences of every byte value to counts. Neighbouring bytes go to different
+// sub-tables, so a run of equal bytes does not wait on its own increments; the 32-bit sub-tables
+// are summed into counts after every chunk, before they could overflow.
+void countBytes(const unsigned char* bytes, size_t size, unsigned long long* counts)
 {
-    std::vector<bool> bits;
+    const int tablesCount = 4;
+    const size_t chunkSize = 1 << 30;
+    unsigned int tables[tablesCount][256];
 
-    for (int i = bitsCount - 1; i >= 0; --i)
+    while (size > 0)
     {
-        int p = (int)pow(2, i);
-        if (p <= num)
+        size_t count = std::min(size, chunkSize);
+        size_t i = 0;
+
+        memset(tables, 0, sizeof(tables));
+        for (; i + 8 <= count; i += 8)
         {
-            num -= p;
-            bits.push_back(true);
+            unsigned long long word;
+            memcpy(&word, bytes + i, 8);
+
+            ++tables[0][word & 0xFF];
+            ++tables[1][(word >> 8) & 0xFF];
+            ++tables[2][(word >> 16) & 0xFF];
+            ++tables[3][(word >> 24) & 0xFF];
+            ++tables[0][(word >> 32) & 0xFF];
+            ++tables[1][(word >> 40) & 0xFF];
+            ++tables[2][(word >> 48) & 0xFF];
+            ++tables[3][word >> 56];
         }
-        else
+
+        for (; i < count; ++i)
         {
-            bits.push_back(false);
+            ++tables[0][bytes[i]];
         }
-    }
 
-    if (num != 0)
-    {
-        for (int i = 0; i < bits.size(); ++i)
+        for (int byte = 0; byte < 256; ++byte)
         {
-            bits[i] = 0;
+            counts[byte] += (unsigned long long)tables[0][byte] + tables[1][byte] + tables[2][byte] + tables[3][byte];
         }
-    }
 
-    return  bits;
+        bytes += count;
+        size -= count;
+    }
 }
 
-unsigned char getByteFromQueue(std::queue<bool>* bits)
+// Counts the bytes of the whole file. The read position is left anywhere, so Reset before reading;
+// a pipe cannot be read again, so callers that read twice collect its bytes themselves.
+void countBytes(FileReader* fileReader, unsigned long long* counts)
 {
-    if (bits->size() < 8)
+    if (fileReader->GetData() != nullptr)
+    {
+        countBytes(fileReader->GetData(), fileReader->GetSize(), counts);
+        return;
+    }
+
+    const int blockSize = 64 * 1024;
+    std::vector<unsigned char> block(blockSize);
+    int readBytes;
+
+    fileReader->Reset();
+    while ((readBytes = fileReader->Read(&block, blockSize)) > 0)
     {
-        return -1;
+        countBytes(&block[0], readBytes, counts);
     }
+}
 
-    unsigned char byte = 0;
+// Order-0 entropy, in bits per byte, of the bytes whose counts are given.
+double getEntropy(const unsigned long long* counts)
+{
+    double total = 0;
+    double entropy = 0;
 
-    for (int i = 7; i >= 0; --i)
+    for (int byte = 0; byte < 256; ++byte)
     {
-        if (bits->front())
+        total += counts[byte];
+    }
+
+    for (int byte = 0; byte < 256; ++byte)
+    {
+        if (counts[byte] > 0)
         {
-            byte += (unsigned char)(std::pow(2, i));
+            entropy -= counts[byte] / total * log2(counts[byte] / total);
         }
-
-        bits->pop();
     }
 
-    return byte;
+    return entropy;
 }
 
-std::vector<bool> getBitsFromBytes(std::vector<unsigned char>& bytes, int count)
+class FileWriter
 {
-    std::vector<bool> bits;
+private:
+    static const size_t bufferSize = 1024 * 1024;
 
-    for (int i = 0; i < count; ++i)
+    std::ofstream* fileStream;
+    std::vector<unsigned char> buffer;
+    size_t used = 0;
+
+public:
+    FileWriter(const std::string filePath)
     {
-        std::vector<bool> tempBits = getBitsFromByte(bytes[i]);
+        fileStream = new std::ofstream(filePath, std::ios::binary | std::ios::out);
+        buffer.resize(bufferSize);
+    }
 
-        for (int j = 0; j < tempBits.size(); ++j)
+    void Flush()
+    {
+        if (used > 0)
         {
-            bits.push_back(tempBits[j]);
+            STATS_TIMER(ioSeconds);
+            STATS_ADD(writeCalls, 1);
+
+            fileStream->write((char *)(&buffer[0]), used);
+            used = 0;
         }
     }
 
-    return bits;
-}
+    void Write(std::vector<unsigned char>* bytes)
+    {
+        Write(&bytes->at(0), bytes->size());
+    }
 
-int getIntFromBits(std::vector<bool>& bits, int count)
-{
-    int num = 0;
-    for (int i = count - 1; i >= 0; --i)
+    void Write(const unsigned char* bytes, size_t size)
     {
-        if (bits[0])
+        if (used + size > buffer.size())
         {
-            num += (int)pow(2, i);
+            Flush();
         }
 
-        bits.erase(bits.begin());
+        if (size >= buffer.size())
+        {
+            STATS_TIMER(ioSeconds);
+            STATS_ADD(writeCalls, 1);
+
+            fileStream->write((const char *)bytes, size);
+        }
+        else
+        {
+            std::memcpy(&buffer[used], bytes, size);
+            used += size;
+        }
     }
 
-    return num;
-}
+    void WriteAt(long long position, std::vector<unsigned char>* bytes)
+    {
+        Flush();
 
-class FileReader
+        STATS_TIMER(ioSeconds);
+        STATS_ADD(writeCalls, 1);
+        fileStream->seekp(position, std::ios::beg);
+        fileStream->write((char *)(&bytes->at(0)), bytes->size());
+    }
+
+    void WriteString(std::string str)
+    {
+        Flush();
+        (*fileStream) << str;
+    }
+
+    ~FileWriter()
+    {
+        Flush();
+        fileStream->flush();
+        fileStream->close();
+        delete fileStream;
+    }
+};
+
+class BitWriter
 {
 private:
-    std::ifstream* fileStream;
+    std::vector<unsigned char>* bytes = nullptr;
+    unsigned char* buffer = nullptr;
+    size_t capacity = 0;
+    size_t size = 0;
+    unsigned long long accumulator = 0;
+    int bitsCount = 0;
+
+    // Room for count more bytes of output, or nullptr when they do not fit in the caller's buffer;
+    // those bytes are still counted in size.
+    unsigned char* append(size_t count)
+    {
+        if (bytes != nullptr)
+        {
+            size_t start = bytes->size();
+            bytes->resize(start + count);
+            return &(*bytes)[start];
+        }
+
+        unsigned char* room = size + count <= capacity ? buffer + size : nullptr;
+        size += count;
+        return room;
+    }
+
+    void appendByte(unsigned char byte)
+    {
+        unsigned char* room = append(1);
+        if (room != nullptr)
+        {
+            *room = byte;
+        }
+    }
+
+    void flushWord()
+    {
+        unsigned char* word = append(4);
+        bitsCount -= 32;
+
+        if (word != nullptr)
+        {
+            word[0] = (unsigned char)(accumulator >> (bitsCount + 24));
+            word[1] = (unsigned char)(accumulator >> (bitsCount + 16));
+            word[2] = (unsigned char)(accumulator >> (bitsCount + 8));
+            word[3] = (unsigned char)(accumulator >> bitsCount);
+        }
+    }
 
 public:
-    FileReader(const std::string filePath)
+    BitWriter(std::vector<unsigned char>* bytes) : bytes(bytes) {}
+
+    // Writes into a buffer of capacity bytes that the caller owns. Output past its end is dropped.
+    BitWriter(unsigned char* buffer, size_t capacity) : buffer(buffer), capacity(capacity) {}
+
+    // Bytes written to the caller's buffer so far, including those that did not fit in it.
+    size_t GetBufferSize()
     {
-        fileStream = new std::ifstream(filePath, std::ios::binary | std::ios::ate);
-        fileStream->seekg(0, std::ios::beg);
+        return size;
     }
 
-    void Reset() 
+    // Appends the lowest count bits of value, most significant bit first.
+    void Write(unsigned long long value, int count)
     {
-        fileStream->seekg(0, std::ios::beg);
+        if (count > 32)
+        {
+            Write(value >> 32, count - 32);
+            count = 32;
+        }
+
+        STATS_ADD(bitsWritten, count);
+        accumulator = (accumulator << count) | (value & ((1ULL << count) - 1));
+        bitsCount += count;
+
+        if (bitsCount >= 32)
+        {
+            flushWord();
+        }
     }
 
-    int Read(std::vector<unsigned char>* bytes, int size)
+    // Moves every complete byte written so far to the output; at most 7 bits stay behind.
+    void FlushBytes()
     {
-        fileStream->read((char *)(&(bytes->at(0))), size);
-        return fileStream->gcount();
+        while (bitsCount >= 8)
+        {
+            bitsCount -= 8;
+            appendByte((unsigned char)(accumulator >> bitsCount));
+        }
     }
 
-    unsigned char ReadNextChar(int& readBytes)
+    // Ends a sync point after its marker: zero bits up to the next byte boundary and two zero bytes.
+    // A receiver holds back the last two bytes it has in case they are the trailer, so it then has
+    // everything written before the marker.
+    void WriteSyncPadding()
     {
-        unsigned char nextChar = 0;
-        fileStream->read((char*)(&nextChar), 1);
-        readBytes = fileStream->gcount();
-        
-        return nextChar;
+        Write(0, (8 - bitsCount % 8) % 8 + 16);
+        FlushBytes();
     }
 
-    static std::vector<bool> ReadAll(std::string filePath)
+    // Pads the last partial byte with zeros and appends the number of its meaningful bits,
+    // which is how every archive in this repository ends.
+    void Close()
     {
-        std::ifstream ifstream(filePath, std::ios::binary | std::ios::ate);
-        auto pos = ifstream.tellg();
-        std::vector<unsigned char> bytes(pos);
+        FlushBytes();
+        appendByte((unsigned char)(accumulator << (8 - bitsCount)));
+        appendByte((unsigned char)bitsCount);
+        accumulator = 0;
+        bitsCount = 0;
+    }
+};
+
+class BitReader
+{
+private:
+    static const int bufferSize = 64 * 1024;
 
-        ifstream.seekg(0, std::ios::beg);
-        ifstream.read((char *)(&bytes[0]), pos);
+    FileReader* fileReader = nullptr;
+    std::vector<unsigned char> buffer;
+    const unsigned char* current;
+    const unsigned char* end;
+    unsigned long long accumulator = 0;
+    int bitsCount = 0;
+    unsigned long long bitsLeft;
 
-        std::vector<bool> fileBits;
-        for (int i = 0; i < bytes.size(); ++i)
+    void refill()
+    {
+        if (end - current >= 8)
         {
-            std::vector<bool> bits = getBitsFromByte(bytes[i]);
-            for (int j = 0; j < bits.size(); ++j)
+            // Whole bytes are counted in; the bits of the partial byte loaded below them are the
+            // ones the next refill loads again at the same place.
+            unsigned long long word = 0;
+            for (int i = 0; i < 8; ++i)
             {
-                fileBits.push_back(bits[j]);
+                word = (word << 8) | current[i];
             }
+
+            int bytesCount = (63 - bitsCount) >> 3;
+            accumulator |= word >> bitsCount;
+            current += bytesCount;
+            bitsCount += bytesCount * 8;
+            return;
         }
 
-        return fileBits;
+        while (bitsCount <= 56)
+        {
+            if (current == end)
+            {
+                if (fileReader == nullptr)
+                {
+                    return;
+                }
+
+                int readBytes = fileReader->Read(&buffer, bufferSize);
+                current = &buffer[0];
+                end = current + readBytes;
+
+                if (readBytes == 0)
+                {
+                    return;
+                }
+            }
+
+            accumulator |= (unsigned long long)(*current++) << (56 - bitsCount);
+            bitsCount += 8;
+        }
     }
 
-    ~FileReader()
+public:
+    BitReader(const unsigned char* bytes, size_t size, unsigned long long bitsLeft) : current(bytes), end(bytes + size), bitsLeft(bitsLeft) {}
+
+    BitReader(FileReader* fileReader, unsigned long long bitsLeft) : fileReader(fileReader), buffer(bufferSize), bitsLeft(bitsLeft)
     {
-        fileStream->close();
-        delete fileStream;
+        current = end = &buffer[0];
+    }
+
+    // Returns the meaningful payload size of an archive closed with BitWriter::Close.
+    static unsigned long long GetPayloadBitsCount(const unsigned char* bytes, size_t size)
+    {
+        return size < 2 ? 0 : (size - 2) * 8ULL + bytes[size - 1];
+    }
+
+    static unsigned long long GetPayloadBitsCount(FileReader* fileReader)
+    {
+        if (fileReader->GetSize() < 2)
+        {
+            return 0;
+        }
+
+        int readBytes;
+        fileReader->Seek(fileReader->GetSize() - 1);
+        unsigned char lastByteSize = fileReader->ReadNextChar(readBytes);
+        fileReader->Reset();
+
+        return (fileReader->GetSize() - 2) * 8ULL + lastByteSize;
+    }
+
+    // Reads the archive straight from the mapped file when possible, otherwise through the stream.
+    static BitReader* Open(FileReader* fileReader)
+    {
+        const unsigned char* data = fileReader->GetData();
+        if (data != nullptr)
+        {
+            return new BitReader(data, fileReader->GetSize(), GetPayloadBitsCount(data, fileReader->GetSize()));
+        }
+
+        return new BitReader(fileReader, GetPayloadBitsCount(fileReader));
+    }
+
+    unsigned long long GetBitsLeft()
+    {
+        return bitsLeft;
+    }
+
+    // Returns the next count bits (1..32) without consuming them; bits past the end read as zeros.
+    unsigned int Peek(int count)
+    {
+        if (bitsCount < count)
+        {
+            refill();
+        }
+
+        return (unsigned int)(accumulator >> (64 - count));
+    }
+
+    // Size of the padding of a sync point whose marker has just been read, see BitWriter::WriteSyncPadding.
+    int GetSyncPaddingBits()
+    {
+        return bitsCount % 8 + 16;
+    }
+
+    void Skip(int count)
+    {
+        STATS_ADD(bitsRead, count);
+        accumulator <<= count;
+        bitsCount -= count;
+        bitsLeft -= count;
+    }
+
+    unsigned int Read(int count)
+    {
+        unsigned int value = Peek(count);
+        Skip(count);
+        return value;
     }
 };
 
-class FileWriter
+// Collects the chunks of an archive that arrives piece by piece and reads the bits received so far.
+// Until the stream is finished its last two bytes are held back, since they may be the trailer.
+class BitStreamBuffer
 {
 private:
-    std::ofstream* fileStream;
+    std::vector<unsigned char> bytes;
+    unsigned long long payloadBits = 0;
+    int bitOffset = 0;
+
 public:
-    FileWriter(const std::string filePath)
+    void Append(const unsigned char* data, size_t size)
     {
-        fileStream = new std::ofstream(filePath, std::ios::binary | std::ios::out);
+        bytes.insert(bytes.end(), data, data + size);
     }
 
-    void Write(std::vector<unsigned char>* bytes)
+    BitReader* Open(bool finished)
     {
-        fileStream->write((char *)(&bytes->at(0)), bytes->size());
+        if (finished)
+        {
+            payloadBits = BitReader::GetPayloadBitsCount(bytes.data(), bytes.size());
+        }
+        else
+        {
+            payloadBits = bytes.size() < 2 ? 0 : (bytes.size() - 2) * 8ULL;
+        }
+
+        BitReader* bitReader = new BitReader(bytes.data(), bytes.size(), payloadBits);
+        if (bitOffset > 0)
+        {
+            bitReader->Read(bitOffset);
+        }
+
+        return bitReader;
     }
 
-    void WriteByte(unsigned char byte)
+    // Drops the bytes the reader has gone past and deletes it.
+    void Close(BitReader* bitReader)
     {
-        fileStream->write((char*)(&byte), 1);
+        unsigned long long consumedBits = payloadBits - bitReader->GetBitsLeft();
+
+        bytes.erase(bytes.begin(), bytes.begin() + consumedBits / 8);
+        bitOffset = consumedBits % 8;
+        delete bitReader;
     }
+};
 
-    void WriteString(std::string str)
+// Writes a value for each byte value present in a table (values[byte] >= 0): the width of the
+// values in widthFieldBits bits, a mask of the 16 ranges of 16 byte values holding any of them,
+// the mask of each such range and then the values themselves.
+void writeSymbolValues(const int* values, int widthFieldBits, BitWriter& bitWriter)
+{
+    int valueBits = 1;
+    unsigned int groupsMask = 0;
+
+    for (int byte = 0; byte < 256; ++byte)
     {
-        (*fileStream) << str;
+        if (values[byte] >= 0)
+        {
+            groupsMask |= 1U << (15 - byte / 16);
+            while ((1 << valueBits) <= values[byte])
+            {
+                ++valueBits;
+            }
+        }
     }
 
-    ~FileWriter()
+    bitWriter.Write(valueBits, widthFieldBits);
+    bitWriter.Write(groupsMask, 16);
+
+    for (int group = 0; group < 16; ++group)
     {
-        fileStream->flush();
-        fileStream->close();
-        delete fileStream;
+        unsigned int symbolsMask = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            if (values[group * 16 + i] >= 0)
+            {
+                symbolsMask |= 1U << (15 - i);
+            }
+        }
+
+        if (symbolsMask != 0)
+        {
+            bitWriter.Write(symbolsMask, 16);
+        }
     }
-};
+
+    for (int byte = 0; byte < 256; ++byte)
+    {
+        if (values[byte] >= 0)
+        {
+            bitWriter.Write(values[byte], valueBits);
+        }
+    }
+}
+
+// Absent byte values get -1.
+void readSymbolValues(BitReader& bitReader, int widthFieldBits, int* values)
+{
+    int valueBits = bitReader.Read(widthFieldBits);
+    unsigned int groupsMask = bitReader.Read(16);
+
+    std::fill(values, values + 256, -1);
+    for (int group = 0; group < 16; ++group)
+    {
+        if ((groupsMask >> (15 - group)) & 1)
+        {
+            unsigned int symbolsMask = bitReader.Read(16);
+            for (int i = 0; i < 16; ++i)
+            {
+                if ((symbolsMask >> (15 - i)) & 1)
+                {
+                    values[group * 16 + i] = 0;
+                }
+            }
+        }
+    }
+
+    for (int byte = 0; byte < 256; ++byte)
+    {
+        if (values[byte] >= 0 && valueBits > 0)
+        {
+            values[byte] = bitReader.Read(valueBits);
+        }
+    }
+}
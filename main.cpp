@@ -1,146 +1,221 @@
+// Needs C++17 for std::filesystem, and threads; g++ 8 also links -lstdc++fs (see .vscode/tasks.json).
 #include <iostream>
-#include <chrono> 
+#include <filesystem>
 
 #include "Archiver.h"
 #include "Util.h"
 #include "Shannon.h"
 #include "LZ77.h"
-
-size_t compareFiles(const std::string firstFile, const std::string secondFile)
+#include "Parallel.h"
+#include "LZSS.h"
+#include "Huffman.h"
+#include "ANS.h"
+#include "Adaptive.h"
+#include "Benchmark.h"
+#include "Corpus.h"
+
+std::vector<std::string> getCorpusFiles(const std::string directory)
 {
-    FileReader firstReader(firstFile);
-    FileReader secondReader(secondFile);
-
-    int firstReadBytes;
-    int secondReadBytes;
-    size_t byteIndex = 0;
+    std::vector<std::string> files;
 
-    while (true)
+    for (const auto& entry : std::filesystem::directory_iterator(directory))
     {
-        unsigned char firstByte;
-        unsigned char secondByte;
-
-        firstByte = firstReader.ReadNextChar(firstReadBytes);
-        secondByte = secondReader.ReadNextChar(secondReadBytes);
-
-        if (firstReadBytes != secondReadBytes || firstByte != secondByte)
+        if (entry.is_regular_file() && entry.path().filename().string()[0] != '.')
         {
-            return ++byteIndex;
+            files.push_back(entry.path().string());
         }
+    }
+
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Sizes are given in bytes or with a K, M or G suffix.
+long long parseSize(const std::string value)
+{
+    long long size = std::stoll(value);
+    char suffix = value.empty() ? 0 : (char)toupper(value.back());
+
+    if (suffix == 'K')
+    {
+        size <<= 10;
+    }
+    else if (suffix == 'M')
+    {
+        size <<= 20;
+    }
+    else if (suffix == 'G')
+    {
+        size <<= 30;
+    }
+
+    return size;
+}
 
-        ++byteIndex;
+std::vector<std::string> split(const std::string value)
+{
+    std::vector<std::string> parts;
+    std::stringstream stream(value);
+    std::string part;
 
-        if (firstReadBytes == 0 && secondReadBytes == 0)
+    while (std::getline(stream, part, ','))
+    {
+        if (!part.empty())
         {
-             return -1;
+            parts.push_back(part);
         }
     }
-}
 
-std::chrono::nanoseconds measureExecutionTime(void (Archiver::*func)(const std::string input, const std::string out),
-                                              Archiver* archiver, std::string inputFile, std::string outFile)
-{   
-    auto start = std::chrono::steady_clock::now();
-    (archiver->*func)(inputFile, outFile);
-    auto end = std::chrono::steady_clock::now();
-    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+    return parts;
 }
 
-std::map<unsigned char, double>* getSymbolsCount(const std::string filePath)
+bool isSelected(const std::string selection, const std::string shortName)
 {
-    FileReader* fr = new FileReader(filePath); 
-    std::map<unsigned char, double>* symbolsFrequencies = new std::map<unsigned char, double>();
-    int readBytes;
+    return selection.empty() || ("," + selection + ",").find("," + shortName + ",") != std::string::npos;
+}
 
-    do
+// Usage: main [corpus directory] [--runs N] [--warmup N] [--archivers name,name] [--csv file] [--json file]
+//             [--synthetic kind,kind --sizes 1K,1M,1G [--seed N]]
+// With --synthetic the inputs are generated in the temporary directory instead of read from the corpus.
+int main(int argc, char** argv)
+{
+    std::string corpusDirectory = "./DATA";
+    std::string selection;
+    std::string syntheticKinds;
+    std::string syntheticSizes = "1K,64K,1M,16M";
+    unsigned long long seed = 1;
+    std::string csvFile;
+    std::string jsonFile;
+    int runs = 5;
+    int warmupRuns = 1;
+
+    for (int i = 1; i < argc; ++i)
     {
-        unsigned char byte = fr->ReadNextChar(readBytes);
+        std::string argument = argv[i];
+        bool hasValue = i + 1 < argc;
 
-        if (symbolsFrequencies->find(byte) == symbolsFrequencies->end())
+        if (argument == "--runs" && hasValue)
+        {
+            runs = std::stoi(argv[++i]);
+        }
+        else if (argument == "--warmup" && hasValue)
+        {
+            warmupRuns = std::stoi(argv[++i]);
+        }
+        else if (argument == "--archivers" && hasValue)
         {
-            symbolsFrequencies->insert(std::make_pair(byte, 1));
+            selection = argv[++i];
+        }
+        else if (argument == "--csv" && hasValue)
+        {
+            csvFile = argv[++i];
+        }
+        else if (argument == "--json" && hasValue)
+        {
+            jsonFile = argv[++i];
+        }
+        else if (argument == "--synthetic" && hasValue)
+        {
+            syntheticKinds = argv[++i];
+        }
+        else if (argument == "--sizes" && hasValue)
+        {
+            syntheticSizes = argv[++i];
+        }
+        else if (argument == "--seed" && hasValue)
+        {
+            seed = std::stoull(argv[++i]);
         }
         else
         {
-            (*symbolsFrequencies)[byte] += 1;
+            corpusDirectory = argument;
         }
+    }
 
-    } while (readBytes == 1);
+    int archiverLength = 10;
+    Archiver** archivers = new Archiver*[10] {new Shannon(), new LZ77Archiver(4 * 1024, 1024), 
+                                             new LZ77Archiver(8 * 1024, 2 * 1024), new LZ77Archiver(16 * 1024, 4 * 1024),
+                                             new ParallelArchiver(new Shannon()), new ParallelArchiver(new LZ77Archiver(16 * 1024, 4 * 1024)),
+                                             new LZSSArchiver(64 * 1024, 1024), new Huffman(), new ANS(),
+                                             new AdaptiveArchiver()};
 
-    delete fr;
+    Benchmark benchmark(runs, warmupRuns);
+    std::vector<BenchmarkResult> results;
+    bool allVerified = true;
 
-    return symbolsFrequencies;
-}
-
-void writeSymbolsCount(std::map<unsigned char, double>* symbolsCounts, const std::string fileName)
-{
-    double symbolsCount = 0;
+    std::vector<std::string> fileNames;
+    CorpusGenerator generator(seed);
 
-    for (auto it = symbolsCounts->begin(); it != symbolsCounts->end(); it++)
+    if (syntheticKinds.empty())
     {
-        symbolsCount += it->second;
+        fileNames = getCorpusFiles(corpusDirectory);
     }
-
-    FileWriter* fw = new FileWriter(fileName);
-    for (int value = 0; value < 256; ++value)
-    {
-        fw->WriteString(std::to_string(symbolsCounts->find(value) == symbolsCounts->end() ? 0 : symbolsCounts->at(value) / symbolsCount));
-        fw->WriteString("\n");    
-    }
-
-    delete fw;
-}
-
-double calculateEntropy(const std::string fileName)
-{
-    std::map<unsigned char, double>* symbolsCounts = getSymbolsCount(fileName);
-    writeSymbolsCount(symbolsCounts, fileName + "sym_count");
-    double entropy = 0;
-    double symbolsCount = 0;
-
-    for (auto it = symbolsCounts->begin(); it != symbolsCounts->end(); it++)
+    else
     {
-        symbolsCount += it->second;
+        for (const std::string& kind : split(syntheticKinds))
+        {
+            if (!CorpusGenerator::IsKind(kind))
+            {
+                std::cerr << "Unknown synthetic kind: " << kind << "\n";
+                return 2;
+            }
+
+            for (const std::string& size : split(syntheticSizes))
+            {
+                fileNames.push_back((std::filesystem::temp_directory_path() / (kind + "_" + size + ".syn")).string());
+            }
+        }
     }
 
-    for (auto it = symbolsCounts->begin(); it != symbolsCounts->end(); it++)
+    for (const std::string& fileName : fileNames)
     {
-        entropy += -(it->second / symbolsCount) * std::log2(it->second / symbolsCount);
-    }
+        if (!syntheticKinds.empty())
+        {
+            std::string name = std::filesystem::path(fileName).stem().string();
+            size_t separator = name.rfind('_');
+            generator.Generate(name.substr(0, separator), parseSize(name.substr(separator + 1)), fileName);
+        }
 
-    delete symbolsCounts;
+        std::cout << fileName << "\n";
+        Benchmark::PrintHeader(std::cout);
 
-    return entropy;
-}
+        for (int j = 0; j < archiverLength; ++j)
+        {
+            if (!isSelected(selection, archivers[j]->GetShortName()))
+            {
+                continue;
+            }
 
-int main()
-{
-    int filesCount = 9;
-    std::string* fileNames = new std::string[9] {"bmp1.bmp", "7.jpg", "8.bmp", "9.bmp", "4.pdf", "1.txt", "2.docx", "6.jpg", "3.pptx" };
+            BenchmarkResult result = benchmark.Run(archivers[j], fileName);
+            Benchmark::PrintResult(std::cout, result);
 
-    int archiverLength = 4;
-    Archiver** archivers = new Archiver*[4] {new Shannon(), new LZ77Archiver(4 * 1024, 1024), 
-                                             new LZ77Archiver(8 * 1024, 2 * 1024), new LZ77Archiver(16 * 1024, 4 * 1024)};
+            allVerified = allVerified && result.verified;
+            results.push_back(result);
+        }
 
-    for (int i = 0; i < filesCount; ++i)
-    {
-        std::string fileName = "./DATA/" + fileNames[i];
-        std::cout << fileName + ". "<< "Entropy: " << calculateEntropy(fileName) / 8 << "\n";
+        std::cout << "\n";
 
-        for (int j = 0; j < archiverLength; ++j)
+        if (!syntheticKinds.empty())
         {
-            std::string archivedFileName =  fileName + "." + archivers[j]->GetShortName();
-            std::string dearchivedFileName =  fileName + ".un" + archivers[j]->GetShortName();
+            std::remove(fileName.c_str());
+        }
+    }
 
-            auto archiveTime = measureExecutionTime(Archiver::Archive, archivers[j], fileName, archivedFileName);
-            std::cout << archivers[j]->GetShortName() << " " << "Archive time: " << archiveTime.count() / 1000000000.0 << "\n";
+    if (!syntheticKinds.empty())
+    {
+        std::cout << "archiver   input                                            size  enc MB/s  dec MB/s   peak MB\n";
+        Benchmark::PrintCurves(std::cout, results);
+    }
 
-            auto dearchivedTime = measureExecutionTime(Archiver::Dearchive, archivers[j], archivedFileName, dearchivedFileName);
-            std::cout << archivers[j]->GetShortName() << " " << "Dearchive time: " << dearchivedTime.count() / 1000000000.0 << "\n";
+    if (!csvFile.empty())
+    {
+        Benchmark::WriteCsv(csvFile, results);
+    }
 
-            std::cout << compareFiles(fileName, fileName + ".un" + archivers[j]->GetShortName()) << "\n";
-        }
+    if (!jsonFile.empty())
+    {
+        Benchmark::WriteJson(jsonFile, results);
     }
- 
-    delete[] fileNames;
-}
\ No newline at end of file
+
+    return allVerified ? 0 : 1;
+}